@@ -556,6 +556,259 @@ void references_vs_pointers() {
     exception.
 */
 
+/**
+    Assertions are compiled out when NDEBUG is defined, as in most release 
+    builds, so a test must not rely on them. CHECK reports the condition and 
+    line of a failed check, counts it, and carries on, so one run shows every 
+    failure. The tests in these notes are run from main, which returns 
+    non-zero if any check failed.
+*/
+
+int check_failures = 0;
+
+void check_failed(const char* condition, int line) {
+    cerr << "Notes.cpp:" << line << ": check failed: " << condition << endl;
+    check_failures++;
+}
+
+#define CHECK(condition) \
+    ((condition) ? (void)0 : check_failed(#condition, __LINE__))
+
+/**
+    Exceptions are cheap when nothing is thrown, but a throw costs 
+    microseconds: the runtime allocates the exception object, then searches 
+    the unwind tables of every frame up to the handler. That is fine for 
+    real errors, but a lookup that misses is not an error, and in a lookup 
+    heavy program misses may be common.
+
+    The alternative is to return the error. A plain error code works but 
+    leaves the result in an out-parameter, where it can be read even after a 
+    failure. Expected<T, E> (after C++23's std::expected) holds either the 
+    value or the error, so a failure is a normal return through the same 
+    registers as a success. It is marked [[nodiscard]], a C++17 attribute 
+    that makes the compiler warn when the result is ignored, which an 
+    exception never needs but a returned error does.
+*/
+
+#include <variant>
+#include <vector>
+#include <algorithm>
+#include <new>
+
+template <class E>
+struct Unexpected {
+    E error;
+};
+
+template <class E>
+Unexpected<E> make_unexpected(E error) {
+    return {error};
+}
+
+template <class T, class E>
+class [[nodiscard]] Expected {
+public:
+    Expected(T value) : _state(in_place_index<0>, move(value)) {}
+    Expected(Unexpected<E> error) : _state(in_place_index<1>, move(error)) {}
+
+    bool has_value() const { return _state.index() == 0; }
+    explicit operator bool() const { return has_value(); }
+
+    // unchecked, like dereferencing a pointer (get<0> would check the index)
+    T& operator*() { return *get_if<0>(&_state); }
+    const T& operator*() const { return *get_if<0>(&_state); }
+    T* operator->() { return get_if<0>(&_state); }
+
+    // checked: a caller that cannot handle the error gets an exception
+    const T& value() const {
+        if (!has_value())
+            throw logic_error("Expected holds an error");
+        return get<0>(_state);
+    }
+    T value_or(T fallback) const {
+        return has_value() ? **this : fallback;
+    }
+    const E& error() const { return get<1>(_state).error; }
+
+    // f(value) returns another Expected; an error is passed straight through
+    template <class F>
+    auto and_then(F f) const -> decltype(f(declval<const T&>())) {
+        if (!has_value())
+            return make_unexpected(error());
+        return f(**this);
+    }
+
+    // f(value) returns a plain value, which is wrapped
+    template <class F>
+    auto transform(F f) const -> Expected<decltype(f(declval<const T&>())), E> {
+        if (!has_value())
+            return make_unexpected(error());
+        return f(**this);
+    }
+
+private:
+    variant<T, Unexpected<E> > _state;
+};
+
+/**
+    For functions of several steps, the macro returns early with the error 
+    if expr failed, and otherwise binds its value to var, e.g.
+
+        ASSIGN_OR_RETURN(i, find_index(v, x, nothrow));
+*/
+#define ASSIGN_OR_RETURN(var, expr) \
+    auto var##_result = (expr); \
+    if (!var##_result) \
+        return make_unexpected(var##_result.error()); \
+    auto var = *var##_result
+
+enum class LookupError {NONE, NOT_FOUND};
+
+/**
+    A lookup then comes in three forms: throwing, an error code, and a 
+    non-throwing overload selected with std::nothrow, as for new (nothrow).
+*/
+
+// Index of x in a sorted vector, by binary search
+size_t find_index(const vector<int>& sorted, int x) {
+    auto it = lower_bound(sorted.begin(), sorted.end(), x);
+    if (it == sorted.end() || *it != x)
+        throw invalid_argument("Number not found");
+    return it - sorted.begin();
+}
+
+[[nodiscard]] LookupError find_index(const vector<int>& sorted, int x, 
+                                     size_t& index) {
+    auto it = lower_bound(sorted.begin(), sorted.end(), x);
+    if (it == sorted.end() || *it != x)
+        return LookupError::NOT_FOUND;
+    index = it - sorted.begin();
+    return LookupError::NONE;
+}
+
+Expected<size_t, LookupError> find_index(const vector<int>& sorted, int x, 
+                                         const nothrow_t&) {
+    auto it = lower_bound(sorted.begin(), sorted.end(), x);
+    if (it == sorted.end() || *it != x)
+        return make_unexpected(LookupError::NOT_FOUND);
+    return it - sorted.begin();
+}
+
+/**
+    A function of several lookups then propagates the first failure, either 
+    with the macro or by chaining.
+*/
+
+// The distance between x and y in a sorted vector
+Expected<size_t, LookupError> index_distance(const vector<int>& sorted, 
+                                             int x, int y) {
+    ASSIGN_OR_RETURN(i, find_index(sorted, x, nothrow));
+    ASSIGN_OR_RETURN(j, find_index(sorted, y, nothrow));
+    return i > j ? i - j : j - i;
+}
+
+void test_expected() {
+    vector<int> sorted = {1, 3, 5, 7};
+    Expected<size_t, LookupError> found = find_index(sorted, 5, nothrow);
+    Expected<size_t, LookupError> missing = find_index(sorted, 4, nothrow);
+    CHECK(found && *found == 2 && found.value() == 2);
+    CHECK(!missing && missing.error() == LookupError::NOT_FOUND);
+    CHECK(missing.value_or(9) == 9);
+    bool threw = false;
+    try {
+        (void)missing.value();
+    } catch (const logic_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    CHECK(*index_distance(sorted, 7, 1) == 3);
+    CHECK(index_distance(sorted, 7, 2).error() == LookupError::NOT_FOUND);
+    CHECK(index_distance(sorted, 0, 1).error() == LookupError::NOT_FOUND);
+
+    // transform wraps the result, and_then must return an Expected itself
+    auto next = [&](size_t i) -> Expected<size_t, LookupError> {
+        if (i + 1 == sorted.size())
+            return make_unexpected(LookupError::NOT_FOUND);
+        return i + 1;
+    };
+    CHECK(*found.transform([&](size_t i) { return sorted[i]; }) == 5);
+    CHECK(!missing.transform([&](size_t i) { return sorted[i]; }));
+    CHECK(*found.and_then(next) == 3);
+    CHECK(!found.and_then(next).and_then(next));
+    CHECK(missing.and_then(next).error() == LookupError::NOT_FOUND);
+}
+
+/**
+    The benchmark looks up 2^20 numbers in a sorted vector with each form, at 
+    miss rates from 0.1% to 50%, and reports nanoseconds per lookup.
+*/
+
+#include <chrono>
+#include <random>
+
+/**
+    A result that is never used may be optimised away, along with the work 
+    that produced it. The benchmarks in these notes pass such results to 
+    do_not_optimize, an empty assembly statement that claims to read them.
+*/
+template <class T>
+inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Wall-clock seconds taken by one call of f
+template <class F>
+double seconds(F f) {
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double>(chrono::steady_clock::now() - start)
+        .count();
+}
+
+void exception_cost_benchmark() {
+    // even numbers are present, odd numbers miss
+    vector<int> sorted(1 << 16);
+    for (size_t i = 0; i < sorted.size(); i++)
+        sorted[i] = 2 * i;
+    mt19937 rng(5);
+    for (double miss_rate : {0.001, 0.01, 0.1, 0.5}) {
+        vector<int> queries(1 << 20);
+        for (int& x : queries)
+            x = 2 * (rng() % sorted.size()) + (rng() < miss_rate * rng.max());
+
+        auto ns_per_lookup = [&](auto lookup) {
+            auto start = chrono::steady_clock::now();
+            size_t total = 0;
+            for (int x : queries)
+                total += lookup(x);
+            chrono::duration<double, nano> t = 
+                chrono::steady_clock::now() - start;
+            do_not_optimize(total);
+            return t.count() / queries.size();
+        };
+        cout << miss_rate * 100 << "% misses: exceptions " 
+             << ns_per_lookup([&](int x) {
+                    try {
+                        return find_index(sorted, x);
+                    } catch (const invalid_argument&) {
+                        return (size_t)0;
+                    }
+                })
+             << " ns, error codes " 
+             << ns_per_lookup([&](int x) {
+                    size_t index = 0;
+                    return find_index(sorted, x, index) == LookupError::NONE 
+                        ? index : 0;
+                })
+             << " ns, expected " 
+             << ns_per_lookup([&](int x) {
+                    return find_index(sorted, x, nothrow).value_or(0);
+                })
+             << " ns" << endl;
+    }
+}
+
 
 /** TEMPLATES
     
@@ -619,189 +872,3721 @@ void thread_example() {
     of the program output.
 */
 
-
-/** MVC
-
-    Model-view-controller (MVC) is an architectural design pattern for user 
-    interfaces. The three components are interconnected as an internal 
-    representation (model), a view (manifestation), and controller (supplying 
-    user interaction). It is very popular in web programming (see Ruby on Rails 
-    and Django for server-side, AngularJS for client-side).
+/** CONCURRENT HASH MAPS
+
+    The obvious way to make a shared map thread-safe is to wrap one mutex 
+    around a std::unordered_map. This is correct, but every thread then 
+    queues on the same lock, so adding threads adds no throughput. Lock 
+    striping splits the table into independent shards, each with its own 
+    lock, and a key only ever locks the shard its hash selects. Threads 
+    touching different shards never wait for one another.
+
+    Each shard uses a reader-writer lock, so any number of readers may 
+    search a shard at once while a writer has it to itself. Resizing is 
+    also per shard: a shard rehashes under its own write lock while the 
+    other shards carry on serving requests, so the map never stops the 
+    world to grow.
+
+    A reader still writes to memory, though: taking a shared lock is an 
+    atomic increment of the lock word, so every read moves the shard's lock 
+    cache line to the reader's core, and readers on different cores fight 
+    over it just as writers would. A seqlock removes that. Writers still 
+    take a mutex, but also make a version counter odd while they modify the 
+    shard and even again when done. A reader only loads the counter, reads 
+    the entry, and loads the counter again; if it was odd or changed, a 
+    writer got in the way and the reader tries again. Readers never write, 
+    so the cache line stays shared among all of them.
+
+    The catch is that a reader may copy an entry while a writer stores it. 
+    On plain memory that is a data race, which is undefined behaviour even 
+    for an int. The seqlock shard therefore stores each entry as atomic 
+    64-bit words, read and written with relaxed loads and stores, which on 
+    x86 are ordinary moves. A reader racing a writer then gets a mix of old 
+    and new words, which is well defined and which the version check makes 
+    it discard. Copying an object word by word is only valid for trivially 
+    copyable types (a std::string would be left pointing at freed memory), 
+    so the map picks the seqlock shard when both K and V are trivially 
+    copyable, and the shared_mutex shard otherwise. The seqlock shard cannot 
+    use std::unordered_map either, whose nodes are freed by erase while a 
+    reader may be following them: it is an open addressing table. A table 
+    outgrown by the shard is kept until the map is destroyed, as a reader 
+    may still be probing it; with the table doubling each time, the old ones 
+    add up to less than the current one.
 */
 
+#include <shared_mutex>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <type_traits>
+
+template <class K, class V, class Hash>
+class LockedShard {
+public:
+    // returns false if the key was already present (the value is kept)
+    bool insert(const K& key, const V& value) {
+        unique_lock<shared_mutex> lock(_mutex);
+        return _map.emplace(key, value).second;
+    }
 
-/** SOFTWARE DESIGN PATTERNS
+    // copies out the value, as a reference would outlive the lock
+    bool find(const K& key, V& value) const {
+        shared_lock<shared_mutex> lock(_mutex);
+        auto it = _map.find(key);
+        if (it == _map.end())
+            return false;
+        value = it->second;
+        return true;
+    }
 
-    Design patterns come in various categories: creational, behavioural, structural, and concurrency.
+    Expected<V, LookupError> find(const K& key) const {
+        shared_lock<shared_mutex> lock(_mutex);
+        auto it = _map.find(key);
+        if (it == _map.end())
+            return make_unexpected(LookupError::NOT_FOUND);
+        return it->second;
+    }
 
-    A creational example is the singleton (ensure only one object of a class exists at a time).
+    bool erase(const K& key) {
+        unique_lock<shared_mutex> lock(_mutex);
+        return _map.erase(key) > 0;
+    }
 
-    A structural example is a proxy i.e. essentially to write a wrapper class.
+    // make() runs at most once per missing key, under the write lock
+    template <class F>
+    V compute_if_absent(const K& key, F make) {
+        {
+            shared_lock<shared_mutex> lock(_mutex);
+            auto it = _map.find(key);
+            if (it != _map.end())
+                return it->second;
+        }
+        unique_lock<shared_mutex> lock(_mutex);
+        auto it = _map.find(key);  // another writer may have won
+        if (it == _map.end())
+            it = _map.emplace(key, make()).first;
+        return it->second;
+    }
 
-    A behavioural example is an iterator.
+    size_t size() const {
+        shared_lock<shared_mutex> lock(_mutex);
+        return _map.size();
+    }
 
-    A concurrency example is join. 
-*/
+private:
+    mutable shared_mutex _mutex;
+    unordered_map<K, V, Hash> _map;
+};
 
+template <class K, class V, class Hash>
+class SeqlockShard {
+    static_assert(is_trivially_copyable<K>::value && 
+                  is_trivially_copyable<V>::value, 
+                  "optimistic reads copy entries while they may be written");
+public:
+    SeqlockShard() {
+        _tables.emplace_back(new Table(4));
+        _table.store(_tables.back().get());
+    }
 
-/** DATA STRUCTURES
+    bool insert(const K& key, const V& value) {
+        lock_guard<mutex> lock(_mutex);
+        Table* table = _table.load(memory_order_relaxed);
+        size_t i = probe(*table, key);
+        if (table->slots[i].load().full)
+            return false;
+        // at most half full, so probe sequences stay short
+        if (2 * (_size + 1) > table->capacity()) {
+            table = grow();
+            i = probe(*table, key);
+        }
+        begin_write();
+        table->slots[i].store({key, value, true});
+        _size++;
+        end_write();
+        return true;
+    }
 
-    At the most basic level, primitive types themselves are data structures--
-    boolean, character, integer, float (32-bit real), double (64-bit real), and 
-    enumerated type (categorical).
+    bool find(const K& key, V& value) const {
+        for (;;) {
+            uint64_t version = _version.load(memory_order_acquire);
+            if (version & 1) {
+                this_thread::yield();  // a writer is in the middle of a change
+                continue;
+            }
+            Entry entry = read(key);
+            atomic_thread_fence(memory_order_acquire);
+            if (_version.load(memory_order_relaxed) != version)
+                continue;
+            if (entry.full)
+                value = entry.value;
+            return entry.full;
+        }
+    }
 
-    Arrays and tuples are considered to be composite data types. There is no 
-    meta-information involved in structuring them, they are just contiguous 
-    groups. It isn't, however, a container.
+    Expected<V, LookupError> find(const K& key) const {
+        V value;
+        if (!find(key, value))
+            return make_unexpected(LookupError::NOT_FOUND);
+        return value;
+    }
 
-    Abstract data types come in several categories: lists, trees, graphs, sets, 
-    queues, associative arrays; with dozens of variants. An associative array 
-    is similar to a hash table, but has some other features.
+    bool erase(const K& key) {
+        lock_guard<mutex> lock(_mutex);
+        Table& table = *_table.load(memory_order_relaxed);
+        size_t hole = probe(table, key);
+        if (!table.slots[hole].load().full)
+            return false;
+        begin_write();
+        // shift later entries of the run back, so no probe stops early
+        for (size_t j = table.next(hole); ; j = table.next(j)) {
+            Entry entry = table.slots[j].load();
+            if (!entry.full)
+                break;
+            size_t home = table.home(Hash()(entry.key));
+            if (table.distance(home, j) >= table.distance(hole, j)) {
+                table.slots[hole].store(entry);
+                hole = j;
+            }
+        }
+        table.slots[hole].store(Entry());
+        _size--;
+        end_write();
+        return true;
+    }
 
-    Some notable examples of the above are:
+    template <class F>
+    V compute_if_absent(const K& key, F make) {
+        V value;
+        if (find(key, value))
+            return value;
+        lock_guard<mutex> lock(_mutex);
+        Table* table = _table.load(memory_order_relaxed);
+        size_t i = probe(*table, key);  // another writer may have won
+        Entry entry = table->slots[i].load();
+        if (entry.full)
+            return entry.value;
+        value = make();
+        if (2 * (_size + 1) > table->capacity()) {
+            table = grow();
+            i = probe(*table, key);
+        }
+        begin_write();
+        table->slots[i].store({key, value, true});
+        _size++;
+        end_write();
+        return value;
+    }
 
-    Linked list: this benefits mainly for space efficiency--N elements are 
-    stored in N containers. Insertion is also straightforward. However, 
-    searching must be linear.
+    size_t size() const {
+        lock_guard<mutex> lock(_mutex);
+        return _size;
+    }
 
-    Binary trees have several variants including binary search trees and 
-    (self-balancing binary) red-black trees. A simple binary search tree (BST) 
-    adds elements to the left if they are less than a root or interior node, 
-    and to the right if greater than. This makes search efficient logN time.
+private:
+    struct Entry {
+        K key;
+        V value;
+        bool full;
+    };
+
+    // An entry as whole atomic words, which readers may load during a store
+    struct Slot {
+        static const size_t N_WORDS = (sizeof(Entry) + 7) / 8;
+
+        Entry load() const {
+            uint64_t words[N_WORDS];
+            for (size_t w = 0; w < N_WORDS; w++)
+                words[w] = _words[w].load(memory_order_relaxed);
+            Entry entry;
+            memcpy((void*)&entry, words, sizeof(Entry));
+            return entry;
+        }
+
+        void store(const Entry& entry) {
+            uint64_t words[N_WORDS] = {};
+            memcpy(words, (const void*)&entry, sizeof(Entry));
+            for (size_t w = 0; w < N_WORDS; w++)
+                _words[w].store(words[w], memory_order_relaxed);
+        }
+
+        atomic<uint64_t> _words[N_WORDS];
+    };
+
+    // capacity is a power of two, indexed by the top bits of the hash
+    struct Table {
+        explicit Table(int bits) : shift(64 - bits), 
+                                   slots(new Slot[(size_t)1 << bits]()) {}
+        size_t capacity() const { return (size_t)1 << (64 - shift); }
+        size_t home(size_t hash) const {
+            // the low bits of the hash also chose the shard, so mix them up
+            return (uint64_t)hash * 0x9e3779b97f4a7c15ULL >> shift;
+        }
+        size_t next(size_t i) const { return (i + 1) & (capacity() - 1); }
+        size_t distance(size_t from, size_t to) const {
+            return (to - from) & (capacity() - 1);
+        }
+
+        int shift;
+        unique_ptr<Slot[]> slots;  // all zero words: every entry empty
+    };
+
+    // the slot holding key, or the empty slot where it would go
+    size_t probe(const Table& table, const K& key) const {
+        size_t i = table.home(Hash()(key));
+        for (;; i = table.next(i)) {
+            Entry entry = table.slots[i].load();
+            if (!entry.full || entry.key == key)
+                return i;
+        }
+    }
 
-    A B-tree is a generalisatoin of a BST in which a node can have multiple 
-    children. Some parameter determines the maximum number of children. There 
-    are some other features such as splitting nodes to improve load balancing. 
-    There also exists such a thing as B+-tree where keys are stored at nodes. 
-    Search times are again logarithmic.
+    /**
+        May see a table being written, so it gives up after one pass rather 
+        than trusting the table to have an empty slot. The entry it returns 
+        is only meaningful if the version did not change meanwhile.
+    */
+    Entry read(const K& key) const {
+        const Table& table = *_table.load(memory_order_acquire);
+        size_t i = table.home(Hash()(key));
+        for (size_t n = 0; n < table.capacity(); n++, i = table.next(i)) {
+            Entry entry = table.slots[i].load();
+            if (!entry.full || entry.key == key)
+                return entry;
+        }
+        return Entry();
+    }
 
-    A trie (or radix tree) is another tree structure where words (or numbers) 
-    are stored by prefix, starting with the null prefix, ø.
+    // builds the new table privately, then publishes it in one store
+    Table* grow() {
+        const Table& old = *_table.load(memory_order_relaxed);
+        Table* table = new Table(64 - old.shift + 1);
+        _tables.emplace_back(table);
+        for (size_t i = 0; i < old.capacity(); i++) {
+            Entry entry = old.slots[i].load();
+            if (entry.full)
+                table->slots[probe(*table, entry.key)].store(entry);
+        }
+        _table.store(table, memory_order_release);
+        return table;
+    }
 
-    A FIFO queue is known as a queue. A LIFO queue is known as a stack. These 
-    are considered linear structures, because they are conceptually similar to 
-    an array with special insertion rules.
+    void begin_write() {
+        _version.store(_version.load(memory_order_relaxed) + 1, 
+                       memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+    }
 
-    Then there are general trees and trees with special relations between nodes 
-    like heaps. Heaps are trees satisfying the heap property, whereby all 
-    children are ordered with respect to their parents. For example, in a "max" 
-    heap, the keys of children are less than or equal to their parents. For 
-    example, given the numbers {2, 3, 17}, a max heap would place 2 and 3 the 
-    children of 17, with no other ordering possible.
-*/
+    void end_write() {
+        _version.store(_version.load(memory_order_relaxed) + 1, 
+                       memory_order_release);
+    }
 
+    mutable mutex _mutex;
+    atomic<uint64_t> _version{0};
+    atomic<Table*> _table;
+    size_t _size = 0;
+    vector<unique_ptr<Table> > _tables;  // the current one last
+};
 
-/** SEARCH, SORTING, ALGORITHMS AND COMPLEXITY
+template <class K, class V, class Hash = std::hash<K>, 
+          class Shard = typename conditional<
+              is_trivially_copyable<K>::value && 
+              is_trivially_copyable<V>::value, 
+              SeqlockShard<K, V, Hash>, LockedShard<K, V, Hash> >::type>
+class ConcurrentHashMap {
+public:
+    explicit ConcurrentHashMap(size_t n_shards = 64) : _shards(n_shards) {
+        if (n_shards == 0)
+            throw invalid_argument("a map needs at least one shard");
+    }
 
-    Searching algorithms depend on the chosen data structure involved, and may 
-    be much faster when the data has some order. Indeed, effort may be expended 
-    on insertion operations, such as in a binary tree, such that when it comes 
-    time to search, the cost is minimised.
-    
-    When dealing with an array, searching algorithms don't leave much to the 
-    imagination. If the array is not sorted, then only one deterministic 
-    algorithm exists--linear search, whereby all elements must be checked until 
-    the sought element is found, costing O(N/2) operations on average (1 in the 
-    best case, N in the worst). If the array is sorted, a binary search can be 
-    completed in at most O(log N) time.
+    // returns false if the key was already present (the value is kept)
+    bool insert(const K& key, const V& value) {
+        return shard_for(key).shard.insert(key, value);
+    }
 
-    Special data structures give no better search performance than an ordered 
-    array, unless an extra space cost is incurred. For example, a hash table 
-    supports O(1) search time, but the data structure must be much larger than 
-    the state space of keys.
+    bool find(const K& key, V& value) const {
+        return shard_for(key).shard.find(key, value);
+    }
 
-    Sorting algorithms are more interesting. These only make sense in the 
-    context of an unsorted array. The simplest/most naive algorithm is 
-    insertion sort. This moves along the array element-wise, and swaps an 
-    element backwards until it is locally sorted. Then the first part of the 
-    array is in order. Continuing assures the whole array is sorted. The 
-    algorithm runs in O(N^2) time on average, and at least O(N) (in the case 
-    the array is already sorted). Clearly, there are at most 1 + 2 + 3 + ... + 
-    N - 1 ~ N^2/2 swaps to make, in the even the array is sorted backwards.
+    Expected<V, LookupError> find(const K& key) const {
+        return shard_for(key).shard.find(key);
+    }
 
-    A much better (and highly popular) sorting algorithm is quicksort. In this 
-    algorithm, a pivot element is chosen (say, the final element) and the other 
-    elements are shuffled/swapped such that all elements less than the pivot 
-    are to the left of the pivot, and those greater are on the right. The 
-    shuffling operation is O(N). The algorithm continues recursively, repeating 
-    this operation for the two unsorted halves, and so on, logN times, until 
-    the array is sorted. The algorithm runs on average in O(NlogN) time. The 
-    assumption is that the array is randomly sorted, so the pivot element has 
-    even chances of being the true median element. In the worst case, the 
-    algorithm runs in O(N^2) time. Heap sort is therefore theoretically 
-    superior, as it never performs worse than O(NlogN).
+    bool erase(const K& key) {
+        return shard_for(key).shard.erase(key);
+    }
 
-    The radix sort algorithm, an inspired method, sorts elements in O(N) time, 
-    incurring a small memory overhead. This works by considering the digits (or 
-    characters) of elements in ascending order. Elements are funnelled to a 
-    series of bins based on this digit. Now the numbers are ordered with 
-    respect to the LSD. The may be return to the list. The operation is 
-    repeated for the second LSD. Now the numbers are ordered with respect to 
-    the second LSD, and wherever the same, ordered with respect to the first 
-    LSD to "break the tie", by virtue of the first round of sorting. This is 
-    repeated until MSD is sorted.
+    // make() runs at most once per missing key, under the shard write lock
+    template <class F>
+    V compute_if_absent(const K& key, F make) {
+        return shard_for(key).shard.compute_if_absent(key, make);
+    }
 
-        55 107 1 54 1000
-    =>  1000 1 54 55 107 ... position after funneling to buckets and returning 
-        to list.
-    =>  1000 01 107  54 55 ... note how 54 and 55, original inverted, retain 
-        the correct order after the first iteration
-    =>  1000 001 054 055 107  ... missing digits are treated as zeros
-    =>  0001 0054 0055 0107 1000 ... and sorting is complete
+    size_t size() const {
+        size_t total = 0;
+        for (const Padded& padded : _shards)
+            total += padded.shard.size();
+        return total;
+    }
 
-    We thus require O(N) memory for the array, and O(kN) memory for the bins, 
-    which are recycled, where k is the maximum number of digits. The time 
-    complexity is O(kN).
-*/
+private:
+    // one cache line per shard, so neighbouring locks don't false share
+    struct alignas(64) Padded {
+        Shard shard;
+    };
+
+    // the shard takes the high bits, leaving the low bits to the buckets
+    Padded& shard_for(const K& key) {
+        return _shards[(Hash()(key) >> 32 ^ Hash()(key)) % _shards.size()];
+    }
+    const Padded& shard_for(const K& key) const {
+        return _shards[(Hash()(key) >> 32 ^ Hash()(key)) % _shards.size()];
+    }
 
-/** VON NEUMANN ARCHITECTURE
+    vector<Padded> _shards;
+};
 
-    The von Neumann architecture is a conceptual design for a computer 
-    architecture by John von Neumann in 1945. It consists of input and output 
-    to a computer consisting of a CPU and memory. The CPU further consists of 
-    a control unit and arithmetic/logic unit.
+/**
+    The races need threads to show. Writers erase and reinsert the odd keys, 
+    then insert fresh keys until the table grows, while readers look up the 
+    even keys, present throughout: a reader that misses one, or sees a wrong 
+    value, has read a half-moved table. The keys go in interleaved and fill 
+    one shard nearly to its maximum load, so runs are long and erases shift 
+    even keys back. Finally every thread calls compute_if_absent on the same 
+    keys, and make() must run once for each.
 */
+void test_concurrent_hash_map_threads() {
+    const long N_KEYS = 4000, N_FRESH = 4000, N_OPS = 100000;
+    const int N_WRITERS = 3, N_READERS = 3;
+    // random keys, as sequential ones hash without collisions
+    mt19937_64 rng(8);
+    vector<long> keys(N_KEYS + N_FRESH);
+    for (long& key : keys)
+        key = rng() >> 1;
+    ConcurrentHashMap<long, long> map(1);
+    for (long i = 0; i < N_KEYS; i++)
+        map.insert(keys[i], ~keys[i]);
+
+    atomic<long> missing{0}, wrong{0};
+    atomic<int> writing{N_WRITERS};
+    vector<thread> threads;
+    for (int t = 0; t < N_WRITERS; t++)
+        threads.emplace_back([&, t] {
+            mt19937_64 rng(t);
+            for (long i = 0; i < N_OPS; i++) {
+                long key = keys[rng() % N_KEYS | 1];
+                if (rng() & 1)
+                    map.insert(key, ~key);
+                else
+                    map.erase(key);
+            }
+            for (long i = N_KEYS + t; i < N_KEYS + N_FRESH; i += N_WRITERS)
+                map.insert(keys[i], ~keys[i]);
+            writing--;
+        });
+    for (int t = 0; t < N_READERS; t++)
+        threads.emplace_back([&, t] {
+            mt19937_64 rng(N_WRITERS + t);
+            long value;
+            while (writing > 0) {
+                long k = rng() % N_KEYS;
+                bool found = map.find(keys[k], value);
+                missing += !found && k % 2 == 0;
+                wrong += found && value != ~keys[k];
+            }
+        });
+    for (thread& t : threads)
+        t.join();
+    CHECK(missing == 0);
+    CHECK(wrong == 0);
+    size_t found = 0;
+    for (long i = 0; i < N_KEYS + N_FRESH; i++) {
+        long value;
+        bool present = map.find(keys[i], value);
+        CHECK(present || (i < N_KEYS && i % 2 == 1));
+        found += present;
+    }
+    CHECK(map.size() == found);  // no key was inserted twice
+
+    ConcurrentHashMap<long, long> computed(2);
+    vector<atomic<int> > calls(1000);
+    threads.clear();
+    for (int t = 0; t < N_WRITERS + N_READERS; t++)
+        threads.emplace_back([&] {
+            for (long key = 0; key < 1000; key++)
+                computed.compute_if_absent(key, [&] {
+                    calls[key]++;
+                    return key;
+                });
+        });
+    for (thread& t : threads)
+        t.join();
+    CHECK(all_of(calls.begin(), calls.end(), 
+                 [](const atomic<int>& n) { return n == 1; }));
+}
 
+void test_concurrent_hash_map() {
+    ConcurrentHashMap<long, long> seqlock(3);
+    ConcurrentHashMap<string, string> locked(3);
+    for (long key = 0; key < 1000; key++) {
+        seqlock.insert(key, key * key);
+        locked.insert(to_string(key), to_string(key * key));
+    }
+    CHECK(!seqlock.insert(7, 0) && !locked.insert("7", "0"));
+    CHECK(seqlock.erase(7) && !seqlock.erase(7) && locked.erase("7"));
+    CHECK(seqlock.size() == 999 && locked.size() == 999);
+
+    long value = 0;
+    CHECK(seqlock.find(8, value) && value == 64);
+    CHECK(*seqlock.find(999) == 998001 && *locked.find("999") == "998001");
+    CHECK(seqlock.find(7).error() == LookupError::NOT_FOUND);
+    CHECK(locked.find("7").error() == LookupError::NOT_FOUND);
+    CHECK(seqlock.compute_if_absent(7, [] { return 1L; }) == 1);
+    CHECK(seqlock.compute_if_absent(7, [] { return 2L; }) == 1);
+
+    bool threw = false;
+    try {
+        ConcurrentHashMap<long, long> no_shards(0);
+    } catch (const invalid_argument&) {
+        threw = true;
+    }
+    CHECK(threw);
 
-/** WHAT IS A BUS/BUSS?
+    test_concurrent_hash_map_threads();
+}
 
-    A system bus is hardware providing a communication channel between hardware 
-    components.
+/**
+    The benchmark below compares a single mutex around an unordered_map with 
+    the sharded map, using shared_mutex shards and then seqlock shards, at 
+    90/10 and 50/50 read/write mixes and 1 to 64 threads. Each thread draws 
+    keys uniformly from a fixed key space.
 */
 
+#include <chrono>
+#include <random>
 
-/** WHAT IS x86?
+class LockedHashMap {
+public:
+    bool insert(long key, long value) {
+        lock_guard<mutex> lock(_mutex);
+        return _map.emplace(key, value).second;
+    }
+    bool find(long key, long& value) const {
+        lock_guard<mutex> lock(_mutex);
+        auto it = _map.find(key);
+        if (it == _map.end())
+            return false;
+        value = it->second;
+        return true;
+    }
+    bool erase(long key) {
+        lock_guard<mutex> lock(_mutex);
+        return _map.erase(key) > 0;
+    }
+private:
+    mutable mutex _mutex;
+    unordered_map<long, long> _map;
+};
 
-    x86 refers to a family (hence the 'x') of 32-bit processors by Intel. x64 
-    is the family of 64-bit processors, which can for example directly 
-    reference memory addresses of size 2^64.
-*/
+template <class Map>
+double hash_map_ops_per_sec(Map& map, int n_threads, int read_percent) {
+    const long n_keys = 1 << 20, n_ops = 1 << 18;
+    auto work = [&](int seed) {
+        mt19937_64 rng(seed);
+        long value;
+        for (long i = 0; i < n_ops; i++) {
+            long key = rng() % n_keys;
+            if ((long)(rng() % 100) < read_percent)
+                map.find(key, value);
+            else if (rng() & 1)
+                map.insert(key, key);
+            else
+                map.erase(key);
+        }
+    };
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int t = 0; t < n_threads; t++)
+        threads.emplace_back(work, t);
+    for (thread& t : threads)
+        t.join();
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return n_threads * n_ops / elapsed.count();
+}
 
+void concurrent_hash_map_benchmark() {
+    for (int read_percent : {90, 50}) {
+        for (int n_threads = 1; n_threads <= 64; n_threads *= 2) {
+            LockedHashMap locked;
+            ConcurrentHashMap<long, long, hash<long>, 
+                              LockedShard<long, long, hash<long> > > shared;
+            ConcurrentHashMap<long, long> seqlock;
+            cout << read_percent << "% reads, " << n_threads << " threads: "
+                 << hash_map_ops_per_sec(locked, n_threads, read_percent)
+                 << " ops/s locked, "
+                 << hash_map_ops_per_sec(shared, n_threads, read_percent)
+                 << " ops/s shared_mutex, "
+                 << hash_map_ops_per_sec(seqlock, n_threads, read_percent)
+                 << " ops/s seqlock" << endl;
+        }
+    }
+}
 
-/** WHAT IS A BOOTSTRAP?
 
-    This describes the self-sustaining process of booting a computer from 
-    simple to complex. It also refers to an early piece of fundamental software 
-    hand-written directly to machine code to allow other software compilers to 
-    be written, to allow other software to be written, in which, paradoxically, 
-    better compilers and bootstraps could be written.
+/** PROCESS POOLS OVER SHARED MEMORY
+
+    A big job can also be split across worker processes rather than threads. 
+    Because each worker has its own address space, a crash (a bad pointer, 
+    an abort) kills that worker alone, and the parent can start a new one and 
+    repeat its unfinished work. Each worker can also be pinned to one NUMA 
+    node, so that it only touches memory attached to its own socket.
+
+    Processes can still share memory, just not by default. memfd_create 
+    makes an anonymous file in memory, and mmap'ing it with MAP_SHARED before 
+    fork() gives the parent and every child the same pages at the same 
+    address. The input and output of the job live in that segment, so nothing 
+    is copied. Work is handed out as small descriptors (a range of the input) 
+    through a single-producer single-consumer (SPSC) ring per worker, also in 
+    the segment, and completions come back through a second ring. An SPSC 
+    ring needs no lock: only the producer writes the tail and only the 
+    consumer writes the head. Atomics work across processes as long as they 
+    are lock-free, since a lock-free atomic is just an instruction on the 
+    shared memory. An idle worker sleeps in futex() on a counter next to its 
+    ring, which the parent bumps after sending work. Futexes on a MAP_SHARED 
+    mapping are keyed by the page rather than the address space, so the wake 
+    reaches the other process.
+
+    The parent keeps every descriptor a worker has not completed. When 
+    waitpid() reports a worker died, its rings are reset, a new worker is 
+    forked, and the unfinished descriptors are sent again. A job must 
+    therefore be idempotent: running a range twice gives the same output.
 */
 
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <new>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+struct WorkItem {
+    uint64_t begin;
+    uint64_t end;
+    bool shutdown;
+};
 
-/** BOOTING
+template <class T, size_t N>
+class SpscRing {
+    static_assert(atomic<uint64_t>::is_always_lock_free, 
+                  "ring must be usable across processes");
+public:
+    bool push(const T& item) {
+        uint64_t tail = _tail.load(memory_order_relaxed);
+        if (tail - _head.load(memory_order_acquire) == N)
+            return false;
+        _items[tail % N] = item;
+        _tail.store(tail + 1, memory_order_release);
+        return true;
+    }
 
-    Booting is essentially putting the computer into a state where it is 
-    interactive to humans, by climbing layers of abstraction.
+    bool pop(T& item) {
+        uint64_t head = _head.load(memory_order_relaxed);
+        if (head == _tail.load(memory_order_acquire))
+            return false;
+        item = _items[head % N];
+        _head.store(head + 1, memory_order_release);
+        return true;
+    }
 
-    The basic input output system (BIOS) is firmware for a particular 
-    motherboard model that initialises i/o hardware at boot time. It is the 
-    first event during booting. It loads a boot loader.
+    // only safe while neither end is in use, e.g. after a worker died
+    void reset() {
+        _head.store(0);
+        _tail.store(0);
+    }
 
-    A boot loader is a small piece of software that puts an OS into memory.
+private:
+    // head and tail on separate cache lines, as each has its own writer
+    alignas(64) atomic<uint64_t> _head{0};
+    alignas(64) atomic<uint64_t> _tail{0};
+    T _items[N];
+};
 
-    An operating system is system software that manages computer hardware and 
-    software resources and provides common services for computer programs.
-*/
+// The CPUs of a node, from the kernel's list such as "0-15,32-47"
+vector<int> numa_node_cpus(int node) {
+    ifstream file("/sys/devices/system/node/node" + to_string(node) + 
+                  "/cpulist");
+    vector<int> cpus;
+    string range;
+    while (getline(file, range, ',')) {
+        int lo, hi;
+        char dash;
+        istringstream parse(range);
+        parse >> lo;
+        if (!(parse >> dash >> hi))
+            hi = lo;
+        for (int cpu = lo; cpu <= hi; cpu++)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+int numa_node_count() {
+    int n = 0;
+    while (!numa_node_cpus(n).empty())
+        n++;
+    return max(n, 1);
+}
+
+/**
+    Pins the calling process to the CPUs of a node. Memory is placed on the 
+    node of the CPU that first writes it, so a pinned worker's output pages 
+    land on its own node without any libnuma calls.
+*/
+void bind_to_numa_node(int node) {
+    vector<int> cpus = numa_node_cpus(node);
+    if (cpus.empty())
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+class ProcessPool {
+public:
+    typedef void (*Job)(char* data, const WorkItem& item);
+
+    ProcessPool(int n_workers, size_t data_bytes, Job job)
+        : _n_workers(n_workers), _n_nodes(numa_node_count()), _job(job), 
+          _pids(n_workers), _in_flight(n_workers), _restarts(0) {
+        _bytes = sizeof(Header) + n_workers * sizeof(Channel) + data_bytes;
+        int fd = memfd_create("process_pool", 0);
+        if (fd < 0 || ftruncate(fd, _bytes) != 0)
+            throw runtime_error("cannot create shared memory segment");
+        void* segment = mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, 
+                             MAP_SHARED, fd, 0);
+        close(fd);  // the mapping keeps the memory alive
+        if (segment == MAP_FAILED)
+            throw runtime_error("cannot map shared memory segment");
+        _header = new (segment) Header();
+        _channels = (Channel*)(_header + 1);
+        for (int w = 0; w < n_workers; w++)
+            new (&_channels[w]) Channel();
+        _data = (char*)(_channels + n_workers);
+        for (int w = 0; w < n_workers; w++)
+            spawn(w);
+    }
+
+    ~ProcessPool() {
+        for (int w = 0; w < _n_workers; w++) {
+            while (!_channels[w].requests.push({0, 0, true}))
+                sched_yield();
+            wake(w);
+            waitpid(_pids[w], nullptr, 0);
+        }
+        munmap(_header, _bytes);
+    }
+
+    // the job's input and output, shared by all workers
+    char* data() { return _data; }
+
+    // blocks until every item has been completed by some worker
+    void run(const vector<WorkItem>& items) {
+        size_t next = 0, done = 0;
+        while (done < items.size()) {
+            for (int w = 0; w < _n_workers; w++) {
+                bool sent = false;
+                while (next < items.size() && 
+                       _in_flight[w].size() < MAX_IN_FLIGHT) {
+                    _channels[w].requests.push(items[next]);
+                    _in_flight[w].push_back(items[next++]);
+                    sent = true;
+                }
+                if (sent)
+                    wake(w);
+                done += collect(w);
+            }
+            // only our own workers, not any other child of this process
+            for (int w = 0; w < _n_workers; w++) {
+                int status;
+                if (waitpid(_pids[w], &status, WNOHANG) == _pids[w]) {
+                    done += collect(w);
+                    restart(w);
+                }
+            }
+            sched_yield();
+        }
+    }
+
+    // the next worker to take an item dies, to measure recovery
+    void crash_one_worker() { _header->crash_next.store(true); }
+    int restarts() const { return _restarts; }
+
+private:
+    static const size_t RING_SIZE = 64;
+    static const size_t MAX_IN_FLIGHT = 4;
+
+    // a whole cache line, so the rings and data after it stay aligned
+    struct alignas(64) Header {
+        atomic<bool> crash_next{false};
+    };
+
+    struct Channel {
+        SpscRing<WorkItem, RING_SIZE> requests;
+        SpscRing<WorkItem, RING_SIZE> completions;
+        // bumped after each send; the futex idle workers wait on
+        alignas(64) atomic<uint32_t> sent{0};
+    };
+    static_assert(sizeof(Channel) % 64 == 0, "data must start on a line");
+
+    void spawn(int w) {
+        pid_t pid = fork();
+        if (pid < 0)
+            throw runtime_error("cannot fork worker");
+        if (pid > 0) {
+            _pids[w] = pid;
+            return;
+        }
+        bind_to_numa_node(w % _n_nodes);
+        Channel& channel = _channels[w];
+        for (;;) {
+            WorkItem item;
+            // read before popping, so a send in between makes the wait return
+            uint32_t sent = channel.sent.load(memory_order_acquire);
+            if (!channel.requests.pop(item)) {
+                syscall(SYS_futex, &channel.sent, FUTEX_WAIT, sent, 
+                        nullptr, nullptr, 0);
+                continue;
+            }
+            if (item.shutdown)
+                _exit(0);
+            if (_header->crash_next.exchange(false))
+                raise(SIGKILL);
+            _job(_data, item);
+            while (!channel.completions.push(item))
+                sched_yield();
+        }
+    }
+
+    // completions arrive in the order the items were sent
+    size_t collect(int w) {
+        size_t n = 0;
+        WorkItem item;
+        while (_channels[w].completions.pop(item)) {
+            _in_flight[w].pop_front();
+            n++;
+        }
+        return n;
+    }
+
+    void restart(int w) {
+        _channels[w].requests.reset();
+        _channels[w].completions.reset();
+        spawn(w);
+        for (const WorkItem& item : _in_flight[w])
+            _channels[w].requests.push(item);
+        wake(w);
+        _restarts++;
+    }
+
+    void wake(int w) {
+        _channels[w].sent.fetch_add(1, memory_order_release);
+        syscall(SYS_futex, &_channels[w].sent, FUTEX_WAKE, 1, 
+                nullptr, nullptr, 0);
+    }
+
+    int _n_workers;
+    int _n_nodes;
+    Job _job;
+    size_t _bytes;
+    Header* _header;
+    Channel* _channels;
+    char* _data;
+    vector<pid_t> _pids;
+    vector<deque<WorkItem> > _in_flight;
+    int _restarts;
+};
+
+/**
+    The benchmark job counts the Collatz steps of every input number, which 
+    is CPU bound and trivially idempotent. It runs on N worker processes, on 
+    N threads of one process, and on N processes where one worker is killed 
+    partway through and replaced.
+*/
+
+const uint64_t COLLATZ_N = 1 << 22;
+
+void collatz_job(char* data, const WorkItem& item) {
+    const uint64_t* input = (const uint64_t*)data;
+    uint32_t* output = (uint32_t*)(data + COLLATZ_N * sizeof(uint64_t));
+    for (uint64_t i = item.begin; i < item.end; i++) {
+        uint32_t steps = 0;
+        for (uint64_t x = input[i]; x > 1; steps++)
+            x = x & 1 ? 3 * x + 1 : x / 2;
+        output[i] = steps;
+    }
+}
+
+void process_pool_benchmark(int n_workers = 8) {
+    const uint64_t N = COLLATZ_N, CHUNK = 1 << 14;
+    const size_t data_bytes = N * (sizeof(uint64_t) + sizeof(uint32_t));
+    vector<WorkItem> items;
+    for (uint64_t i = 0; i < N; i += CHUNK)
+        items.push_back({i, i + CHUNK, false});
+
+    // the workers exit before the threads are timed
+    double processes, crashed;
+    int restarts;
+    {
+        ProcessPool pool(n_workers, data_bytes, collatz_job);
+        for (uint64_t i = 0; i < N; i++)
+            ((uint64_t*)pool.data())[i] = i + 1;
+        processes = seconds([&] { pool.run(items); });
+        pool.crash_one_worker();
+        crashed = seconds([&] { pool.run(items); });
+        restarts = pool.restarts();
+    }
+
+    vector<char> data(data_bytes);
+    for (uint64_t i = 0; i < N; i++)
+        ((uint64_t*)data.data())[i] = i + 1;
+    double threads = seconds([&] {
+        atomic<size_t> next{0};
+        vector<thread> workers;
+        for (int t = 0; t < n_workers; t++)
+            workers.emplace_back([&] {
+                for (size_t i; (i = next++) < items.size(); )
+                    collatz_job(data.data(), items[i]);
+            });
+        for (thread& t : workers)
+            t.join();
+    });
+
+    cout << n_workers << " processes: " << processes << " s, " 
+         << n_workers << " threads: " << threads << " s, with " 
+         << restarts << " crash and restart: " << crashed << " s" 
+         << endl;
+}
+
+/**
+    The pool must fill in every output, including after a worker is killed 
+    mid-run and its unfinished items are sent to a new one. The outputs are 
+    cleared between runs, so an item that was lost stays zero.
+*/
+
+const uint64_t POOL_TEST_N = 1 << 16;
+
+void square_job(char* data, const WorkItem& item) {
+    uint64_t* values = (uint64_t*)data;
+    for (uint64_t i = item.begin; i < item.end; i++)
+        values[POOL_TEST_N + i] = values[i] * values[i];
+}
+
+void test_process_pool() {
+    vector<WorkItem> items;
+    for (uint64_t i = 0; i < POOL_TEST_N; i += 1 << 10)
+        items.push_back({i, i + (1 << 10), false});
+    ProcessPool pool(3, 2 * POOL_TEST_N * sizeof(uint64_t), square_job);
+    uint64_t* values = (uint64_t*)pool.data();
+    for (uint64_t i = 0; i < POOL_TEST_N; i++)
+        values[i] = i + 1;
+
+    for (int crashes = 0; crashes <= 2; crashes++) {
+        fill(values + POOL_TEST_N, values + 2 * POOL_TEST_N, 0);
+        if (crashes > 0)
+            pool.crash_one_worker();
+        pool.run(items);
+        bool squared = true;
+        for (uint64_t i = 0; i < POOL_TEST_N; i++)
+            squared &= values[POOL_TEST_N + i] == (i + 1) * (i + 1);
+        CHECK(squared);
+        CHECK(pool.restarts() == crashes);
+    }
+}
+
+
+/** THREAD-CACHING ALLOCATORS
+
+    Recall from STACK VS. HEAP that threads usually share one heap, which 
+    must therefore be thread-safe. In a general-purpose malloc that means a 
+    lock (or several), and with many threads allocating at once the heap 
+    becomes the contended part of the program. A thread-caching allocator 
+    gives each thread its own heap, so the common case of a thread freeing 
+    what it allocated takes no lock at all.
+
+    Memory comes from the OS in spans of 256 KB, aligned to their size, so 
+    the span of any object is found by clearing the low bits of its address. 
+    A span is carved into objects of one size class (powers of two from 16 B 
+    to 32 KB) and belongs to one thread heap, which keeps a free list per 
+    span. Spans are the batches of the design: a heap takes a whole span from 
+    the central pool under its lock, hands out thousands of objects without 
+    it, and gives the span back once every object in it is free. The central 
+    pool unmaps spans that have sat unused for a second, and 
+    caching_release_memory() unmaps all of them, e.g. when the program is 
+    idle. Larger objects are mapped individually.
+
+    When a thread frees an object owned by another thread's heap, it cannot 
+    touch that heap's free lists. Instead it pushes the object onto the 
+    owner's remote-free list for that size class, a lock-free stack (CAS on 
+    the head pointer). The owner takes the whole list with one atomic 
+    exchange when it runs out of free objects of that class. This is what 
+    keeps producer/consumer programs, where one thread allocates and another 
+    frees, from needing a lock either.
+
+    When a thread exits its heap is returned to a pool and adopted by the 
+    next new thread, along with any remote frees sent to it in the meantime. 
+    The allocator's own bookkeeping never calls new, so defining 
+    CACHING_GLOBAL_NEW makes it replace the global operator new and delete; 
+    otherwise it is used explicitly, e.g. through CachingAllocator<T>.
+*/
+
+#include <map>
+#include <string>
+
+const size_t SPAN_SIZE = 256 << 10;
+const int N_SIZE_CLASSES = 12;
+const size_t MAX_SMALL_SIZE = 16 << (N_SIZE_CLASSES - 1);
+
+struct ThreadHeap;
+
+// The header at the start of every span
+struct Span {
+    ThreadHeap* owner;
+    int size_class;     // -1 for a single large object
+    bool linked;        // in its owner's list of spans with a free object
+    uint32_t used;
+    size_t bytes;
+    char* bump;         // objects from here on were never handed out
+    void* free_list;    // each free object holds the next pointer
+    Span* prev;
+    Span* next;
+    chrono::steady_clock::time_point freed_at;
+};
+
+const size_t SPAN_HEADER = (sizeof(Span) + 63) / 64 * 64;
+
+struct ThreadHeap {
+    Span* spans[N_SIZE_CLASSES];
+    atomic<void*> remote_free[N_SIZE_CLASSES];
+    ThreadHeap* next;
+};
+
+inline int size_class(size_t n) {
+    return n <= 16 ? 0 : 64 - __builtin_clzll(n - 1) - 4;
+}
+
+inline size_t class_size(int c) {
+    return (size_t)16 << c;
+}
+
+inline Span* span_of(void* p) {
+    return (Span*)((uintptr_t)p & ~(SPAN_SIZE - 1));
+}
+
+// Maps bytes (a multiple of the page size) at a SPAN_SIZE boundary
+void* map_aligned(size_t bytes) {
+    size_t total = bytes + SPAN_SIZE;
+    char* raw = (char*)mmap(nullptr, total, PROT_READ | PROT_WRITE, 
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return nullptr;
+    char* aligned = (char*)(((uintptr_t)raw + SPAN_SIZE - 1) & 
+                            ~(SPAN_SIZE - 1));
+    if (aligned > raw)
+        munmap(raw, aligned - raw);
+    if (raw + total > aligned + bytes)
+        munmap(aligned + bytes, raw + total - (aligned + bytes));
+    return aligned;
+}
+
+class CentralPool {
+public:
+    Span* take() {
+        {
+            lock_guard<mutex> lock(_mutex);
+            if (_free) {
+                Span* span = _free;
+                _free = span->next;
+                return span;
+            }
+        }
+        return (Span*)map_aligned(SPAN_SIZE);
+    }
+
+    void give(Span* span) {
+        lock_guard<mutex> lock(_mutex);
+        auto now = chrono::steady_clock::now();
+        span->freed_at = now;
+        span->next = _free;
+        _free = span;
+        release(now - chrono::seconds(1));
+    }
+
+    void release_all() {
+        lock_guard<mutex> lock(_mutex);
+        release(chrono::steady_clock::time_point::max());
+    }
+
+private:
+    // the list is newest first, so everything after the first old span is old
+    void release(chrono::steady_clock::time_point freed_before) {
+        Span** link = &_free;
+        while (*link && (*link)->freed_at >= freed_before)
+            link = &(*link)->next;
+        Span* old = *link;
+        *link = nullptr;
+        while (old) {
+            Span* next = old->next;
+            munmap(old, SPAN_SIZE);
+            old = next;
+        }
+    }
+
+    mutex _mutex;
+    Span* _free = nullptr;
+};
+
+CentralPool& central_pool() {
+    static CentralPool pool;
+    return pool;
+}
+
+class HeapPool {
+public:
+    ThreadHeap* acquire() {
+        lock_guard<mutex> lock(_mutex);
+        if (_unowned) {
+            ThreadHeap* heap = _unowned;
+            _unowned = heap->next;
+            return heap;
+        }
+        void* memory = mmap(nullptr, sizeof(ThreadHeap), 
+                            PROT_READ | PROT_WRITE, 
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return memory == MAP_FAILED ? nullptr : new (memory) ThreadHeap();
+    }
+
+    void release(ThreadHeap* heap) {
+        lock_guard<mutex> lock(_mutex);
+        heap->next = _unowned;
+        _unowned = heap;
+    }
+
+private:
+    mutex _mutex;
+    ThreadHeap* _unowned = nullptr;
+};
+
+HeapPool& heap_pool() {
+    static HeapPool pool;
+    return pool;
+}
+
+thread_local ThreadHeap* t_heap = nullptr;
+
+struct HeapReturner {
+    ~HeapReturner() {
+        if (t_heap)
+            heap_pool().release(t_heap);
+        t_heap = nullptr;
+    }
+};
+
+/**
+    The returner's destructor runs at thread exit. Should the thread allocate 
+    again after that, it gets a heap that is never returned, which is a leak 
+    of one heap, not of its objects: they can still be freed remotely.
+*/
+ThreadHeap* this_heap() {
+    if (!t_heap) {
+        t_heap = heap_pool().acquire();
+        static thread_local HeapReturner returner;
+        (void)returner;
+    }
+    return t_heap;
+}
+
+void link_span(ThreadHeap* heap, Span* span) {
+    Span*& head = heap->spans[span->size_class];
+    span->prev = nullptr;
+    span->next = head;
+    if (head)
+        head->prev = span;
+    head = span;
+    span->linked = true;
+}
+
+void unlink_span(ThreadHeap* heap, Span* span) {
+    if (span->prev)
+        span->prev->next = span->next;
+    else
+        heap->spans[span->size_class] = span->next;
+    if (span->next)
+        span->next->prev = span->prev;
+    span->linked = false;
+}
+
+void local_free(ThreadHeap* heap, Span* span, void* p) {
+    *(void**)p = span->free_list;
+    span->free_list = p;
+    span->used--;
+    if (!span->linked)
+        link_span(heap, span);
+    // keep the last span of a class, so one object can't thrash the pool
+    if (span->used == 0 && (span->prev || span->next)) {
+        unlink_span(heap, span);
+        central_pool().give(span);
+    }
+}
+
+void drain_remote_frees(ThreadHeap* heap, int c) {
+    void* p = heap->remote_free[c].exchange(nullptr, memory_order_acquire);
+    while (p) {
+        void* next = *(void**)p;
+        local_free(heap, span_of(p), p);
+        p = next;
+    }
+}
+
+void* allocate_large(size_t n) {
+    size_t bytes = (SPAN_HEADER + n + 4095) / 4096 * 4096;
+    Span* span = (Span*)map_aligned(bytes);
+    if (!span)
+        return nullptr;
+    span->size_class = -1;
+    span->bytes = bytes;
+    return (char*)span + SPAN_HEADER;
+}
+
+// Returns nullptr when out of memory, like malloc
+void* caching_allocate(size_t n) {
+    if (n > MAX_SMALL_SIZE)
+        return allocate_large(n);
+    int c = size_class(n);
+    ThreadHeap* heap = this_heap();
+    if (!heap)
+        return nullptr;
+    if (!heap->spans[c])
+        drain_remote_frees(heap, c);
+    Span* span = heap->spans[c];
+    if (!span) {
+        span = central_pool().take();
+        if (!span)
+            return nullptr;
+        *span = Span();
+        span->owner = heap;
+        span->size_class = c;
+        span->bytes = SPAN_SIZE;
+        span->bump = (char*)span + SPAN_HEADER;
+        link_span(heap, span);
+    }
+
+    void* p;
+    if (span->free_list) {
+        p = span->free_list;
+        span->free_list = *(void**)p;
+    } else {
+        p = span->bump;
+        span->bump += class_size(c);
+    }
+    span->used++;
+    // the list only holds spans with a free object
+    if (!span->free_list && 
+        span->bump + class_size(c) > (char*)span + SPAN_SIZE)
+        unlink_span(heap, span);
+    return p;
+}
+
+void caching_deallocate(void* p) {
+    if (!p)
+        return;
+    Span* span = span_of(p);
+    if (span->size_class < 0) {
+        munmap(span, span->bytes);
+        return;
+    }
+    // a thread that only frees never needs a heap of its own
+    if (span->owner == t_heap) {
+        local_free(t_heap, span, p);
+        return;
+    }
+    atomic<void*>& remote = span->owner->remote_free[span->size_class];
+    void* head = remote.load(memory_order_relaxed);
+    do
+        *(void**)p = head;
+    while (!remote.compare_exchange_weak(head, p, memory_order_release, 
+                                         memory_order_relaxed));
+}
+
+// Returns every cached free span to the OS
+void caching_release_memory() {
+    central_pool().release_all();
+}
+
+template <class T>
+struct CachingAllocator {
+    typedef T value_type;
+
+    CachingAllocator() = default;
+    template <class U>
+    CachingAllocator(const CachingAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        void* p = caching_allocate(n * sizeof(T));
+        if (!p)
+            throw bad_alloc();
+        return (T*)p;
+    }
+    void deallocate(T* p, size_t) { caching_deallocate(p); }
+};
+
+template <class T, class U>
+bool operator==(const CachingAllocator<T>&, const CachingAllocator<U>&) {
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const CachingAllocator<T>&, const CachingAllocator<U>&) {
+    return false;
+}
+
+#ifdef CACHING_GLOBAL_NEW
+void* operator new(size_t n) {
+    void* p = caching_allocate(n ? n : 1);
+    if (!p)
+        throw bad_alloc();
+    return p;
+}
+void* operator new[](size_t n) { return operator new(n); }
+void* operator new(size_t n, const nothrow_t&) noexcept {
+    return caching_allocate(n ? n : 1);
+}
+void* operator new[](size_t n, const nothrow_t&) noexcept {
+    return caching_allocate(n ? n : 1);
+}
+void operator delete(void* p) noexcept { caching_deallocate(p); }
+void operator delete[](void* p) noexcept { caching_deallocate(p); }
+void operator delete(void* p, size_t) noexcept { caching_deallocate(p); }
+void operator delete[](void* p, size_t) noexcept { caching_deallocate(p); }
+#endif
+
+/**
+    The benchmark pairs producer threads, which allocate objects of 16 to 
+    512 bytes, with consumer threads, which free them, connected by an SPSC 
+    ring (see PROCESS POOLS). Every free is therefore a cross-thread free. 
+    With one thread, it allocates and frees batches itself.
+*/
+void allocator_benchmark() {
+    struct Api {
+        const char* name;
+        void* (*allocate)(size_t);
+        void (*deallocate)(void*);
+    };
+    const Api APIS[] = {{"glibc malloc", malloc, free}, 
+                        {"caching", caching_allocate, caching_deallocate}};
+    const size_t OBJECTS = 1 << 20;
+
+    for (int n_threads = 1; n_threads <= 64; n_threads *= 2) {
+        cout << n_threads << " threads:";
+        for (const Api& api : APIS) {
+            auto start = chrono::steady_clock::now();
+            int pairs = max(1, n_threads / 2);
+            unique_ptr<SpscRing<void*, 1024>[]> rings(
+                new SpscRing<void*, 1024>[pairs]);
+            auto produce = [&](int pair) {
+                for (size_t i = 0; i < OBJECTS; i++) {
+                    char* p = (char*)api.allocate(16 + i * 37 % 497);
+                    p[0] = 1;
+                    while (!rings[pair].push(p))
+                        this_thread::yield();
+                }
+            };
+            auto consume = [&](int pair) {
+                void* p;
+                for (size_t i = 0; i < OBJECTS; i++) {
+                    while (!rings[pair].pop(p))
+                        this_thread::yield();
+                    api.deallocate(p);
+                }
+            };
+            if (n_threads == 1) {
+                vector<void*> batch(256);
+                for (size_t i = 0; i < OBJECTS; i += batch.size()) {
+                    for (size_t j = 0; j < batch.size(); j++)
+                        batch[j] = api.allocate(16 + (i + j) * 37 % 497);
+                    for (void* p : batch)
+                        api.deallocate(p);
+                }
+            } else {
+                vector<thread> threads;
+                for (int pair = 0; pair < pairs; pair++) {
+                    threads.emplace_back(produce, pair);
+                    threads.emplace_back(consume, pair);
+                }
+                for (thread& t : threads)
+                    t.join();
+            }
+            chrono::duration<double> t = chrono::steady_clock::now() - start;
+            cout << " " << api.name << " " 
+                 << pairs * OBJECTS / t.count() / 1e6 << " M/s";
+        }
+        cout << endl;
+    }
+}
+
+/**
+    Whether memory went back is seen from outside: msync() fails with ENOMEM 
+    on an address that is no longer mapped, so a span the central pool 
+    released, or a large object after its free, must fail it. Each object 
+    holds a pattern from allocation until its free, so objects handed out 
+    twice show up as a broken pattern. Built with -DCACHING_GLOBAL_NEW, every 
+    other test also runs on this allocator.
+*/
+bool is_mapped(void* p) {
+    return msync((void*)((uintptr_t)p & ~(uintptr_t)4095), 4096, 
+                 MS_ASYNC) == 0;
+}
+
+void test_caching_allocator() {
+    // remote frees: one thread frees what another allocated, many times over
+    const size_t N = 20000;
+    vector<char*> objects(N);
+    vector<Span*> spans;
+    size_t broken = 0;
+    for (int round = 0; round < 50; round++) {
+        thread([&] {
+            for (size_t i = 0; i < N; i++) {
+                objects[i] = (char*)caching_allocate(64);
+                memset(objects[i], (int)(i % 251), 64);
+            }
+        }).join();
+        thread([&] {
+            for (size_t i = 0; i < N; i++) {
+                broken += objects[i][0] != (char)(i % 251) || 
+                          objects[i][63] != (char)(i % 251);
+                caching_deallocate(objects[i]);
+            }
+        }).join();
+        for (char* p : objects)
+            spans.push_back(span_of(p));
+    }
+    sort(spans.begin(), spans.end());
+    spans.erase(unique(spans.begin(), spans.end()), spans.end());
+    CHECK(broken == 0);
+    // the heap is adopted by the next thread, and drains the remote frees
+    CHECK(spans.size() < 4 * N * 64 / SPAN_SIZE);
+
+    // spans go back to the central pool once empty, except a class's last
+    thread([] {
+        const size_t N_OBJECTS = 8 * SPAN_SIZE / 1024;
+        vector<void*> blocks(N_OBJECTS);
+        for (void*& p : blocks)
+            p = caching_allocate(1024);
+        vector<Span*> used;
+        for (void* p : blocks)
+            used.push_back(span_of(p));
+        for (void* p : blocks)
+            caching_deallocate(p);
+        caching_release_memory();
+        used.erase(unique(used.begin(), used.end()), used.end());
+        CHECK(used.size() >= 8);
+        CHECK(count_if(used.begin(), used.end(), is_mapped) <= 2);
+    }).join();
+
+    // large objects are mapped and unmapped one by one
+    for (size_t n : {MAX_SMALL_SIZE + 1, (size_t)100000, (size_t)1 << 22}) {
+        char* p = (char*)caching_allocate(n);
+        CHECK(p && (uintptr_t)p % 64 == 0);
+        memset(p, 1, n);
+        CHECK(p[n - 1] == 1);
+        caching_deallocate(p);
+        CHECK(!is_mapped(p));
+    }
+    bool aligned = true;
+    for (size_t n = 1; n <= MAX_SMALL_SIZE; n = n * 3 / 2 + 1) {
+        void* p = caching_allocate(n);
+        aligned &= (uintptr_t)p % min<size_t>(class_size(size_class(n)), 
+                                              64) == 0;
+        caching_deallocate(p);
+    }
+    CHECK(aligned);
+
+    // containers, destroyed on another thread than the one that filled them
+    typedef basic_string<char, char_traits<char>, CachingAllocator<char> > 
+        CachingString;
+    vector<int, CachingAllocator<int> > numbers;
+    map<int, CachingString, less<int>, 
+        CachingAllocator<pair<const int, CachingString> > > names;
+    thread([&] {
+        for (int i = 0; i < 100000; i++)
+            numbers.push_back(i);
+        for (int i = 0; i < 1000; i++)
+            names[i] = CachingString(i % 100 + 1, (char)('a' + i % 26));
+        for (int i = 0; i < 1000; i += 2)
+            names.erase(i);
+    }).join();
+    bool same = numbers.size() == 100000 && names.size() == 500;
+    for (int i = 0; i < (int)numbers.size(); i++)
+        same &= numbers[i] == i;
+    for (const auto& entry : names)
+        same &= entry.first % 2 == 1 && 
+                entry.second == CachingString(entry.first % 100 + 1, 
+                                              (char)('a' + entry.first % 26));
+    CHECK(same);
+    numbers = vector<int, CachingAllocator<int> >();
+    names.clear();
+
+    // producer/consumer pairs, as in the benchmark, of mixed sizes
+    const int PAIRS = 4;
+    const size_t PER_PAIR = 200000;
+    unique_ptr<SpscRing<void*, 1024>[]> rings(new SpscRing<void*, 1024>[PAIRS]);
+    atomic<size_t> corrupt{0};
+    vector<thread> threads;
+    for (int pair = 0; pair < PAIRS; pair++) {
+        threads.emplace_back([&, pair] {
+            for (size_t i = 0; i < PER_PAIR; i++) {
+                size_t n = 16 + i * 37 % 2000;
+                char* p = (char*)caching_allocate(n);
+                memcpy(p, &n, sizeof(n));
+                memset(p + sizeof(n), (int)(n % 256), n - sizeof(n));
+                while (!rings[pair].push(p))
+                    this_thread::yield();
+            }
+        });
+        threads.emplace_back([&, pair] {
+            void* p;
+            for (size_t i = 0; i < PER_PAIR; i++) {
+                while (!rings[pair].pop(p))
+                    this_thread::yield();
+                size_t n;
+                memcpy(&n, p, sizeof(n));
+                const char* bytes = (const char*)p;
+                corrupt += n != 16 + i * 37 % 2000 || 
+                           bytes[n - 1] != (char)(n % 256);
+                caching_deallocate(p);
+            }
+        });
+    }
+    for (thread& t : threads)
+        t.join();
+    CHECK(corrupt == 0);
+
+#ifdef CACHING_GLOBAL_NEW
+    int* global = new int(7);
+    CHECK(span_of(global)->owner == this_heap());
+    delete global;
+#endif
+}
+
+
+/** MVC
+
+    Model-view-controller (MVC) is an architectural design pattern for user 
+    interfaces. The three components are interconnected as an internal 
+    representation (model), a view (manifestation), and controller (supplying 
+    user interaction). It is very popular in web programming (see Ruby on Rails 
+    and Django for server-side, AngularJS for client-side).
+*/
+
+
+/** SOFTWARE DESIGN PATTERNS
+
+    Design patterns come in various categories: creational, behavioural, structural, and concurrency.
+
+    A creational example is the singleton (ensure only one object of a class exists at a time).
+
+    A structural example is a proxy i.e. essentially to write a wrapper class.
+
+    A behavioural example is an iterator.
+
+    A concurrency example is join. 
+*/
+
+
+/** DATA STRUCTURES
+
+    At the most basic level, primitive types themselves are data structures--
+    boolean, character, integer, float (32-bit real), double (64-bit real), and 
+    enumerated type (categorical).
+
+    Arrays and tuples are considered to be composite data types. There is no 
+    meta-information involved in structuring them, they are just contiguous 
+    groups. It isn't, however, a container.
+
+    Abstract data types come in several categories: lists, trees, graphs, sets, 
+    queues, associative arrays; with dozens of variants. An associative array 
+    is similar to a hash table, but has some other features.
+
+    Some notable examples of the above are:
+
+    Linked list: this benefits mainly for space efficiency--N elements are 
+    stored in N containers. Insertion is also straightforward. However, 
+    searching must be linear.
+
+    Binary trees have several variants including binary search trees and 
+    (self-balancing binary) red-black trees. A simple binary search tree (BST) 
+    adds elements to the left if they are less than a root or interior node, 
+    and to the right if greater than. This makes search efficient logN time.
+
+    A B-tree is a generalisatoin of a BST in which a node can have multiple 
+    children. Some parameter determines the maximum number of children. There 
+    are some other features such as splitting nodes to improve load balancing. 
+    There also exists such a thing as B+-tree where keys are stored at nodes. 
+    Search times are again logarithmic.
+
+    A trie (or radix tree) is another tree structure where words (or numbers) 
+    are stored by prefix, starting with the null prefix, ø.
+
+    A FIFO queue is known as a queue. A LIFO queue is known as a stack. These 
+    are considered linear structures, because they are conceptually similar to 
+    an array with special insertion rules.
+
+    Then there are general trees and trees with special relations between nodes 
+    like heaps. Heaps are trees satisfying the heap property, whereby all 
+    children are ordered with respect to their parents. For example, in a "max" 
+    heap, the keys of children are less than or equal to their parents. For 
+    example, given the numbers {2, 3, 17}, a max heap would place 2 and 3 the 
+    children of 17, with no other ordering possible.
+*/
+
+/** GRAPHS IN COMPRESSED SPARSE ROW FORM
+
+    A graph is usually drawn as nodes pointing at each other, and the naive 
+    implementation is a vector of neighbour vectors. At billions of edges that 
+    is billions of tiny heap allocations scattered through memory. Compressed 
+    sparse row (CSR) form packs every adjacency list end to end into one 
+    targets array, and keeps an offsets array of N + 1 entries, so that the 
+    neighbours of v are targets[offsets[v]] up to targets[offsets[v + 1]]. The 
+    graph is immutable once built, but a traversal is then just a walk along 
+    two arrays. Vertex IDs are 32-bit, which halves the targets array compared 
+    to pointers or 64-bit indices.
+
+    Building from an edge list is a counting sort keyed on the source vertex: 
+    count the out-degree of each vertex, prefix sum the counts into offsets, 
+    then scatter each edge to the next free slot of its source. The counting 
+    and the scatter both run in parallel using atomic counters.
+*/
+
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <queue>
+
+// Splits [0, n) into one contiguous range per core and runs f(tid, lo, hi)
+template <class F>
+void parallel_ranges(size_t n, F f) {
+    size_t n_threads = max(1u, thread::hardware_concurrency());
+    size_t chunk = (n + n_threads - 1) / n_threads;
+    vector<thread> threads;
+    for (size_t t = 0; t < n_threads && t * chunk < n; t++)
+        threads.emplace_back(f, t, t * chunk, min(n, (t + 1) * chunk));
+    for (thread& t : threads)
+        t.join();
+}
+
+template <class F>
+void parallel_for(size_t n, F f) {
+    parallel_ranges(n, [&f](size_t, size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; i++)
+            f(i);
+    });
+}
+
+const uint32_t NO_VERTEX = numeric_limits<uint32_t>::max();
+
+struct Edge {
+    uint32_t src;
+    uint32_t dst;
+    float weight;
+};
+
+class CsrGraph {
+public:
+    CsrGraph(uint32_t n_vertices, const vector<Edge>& edges)
+        : _offsets(n_vertices + 1), _targets(edges.size()), 
+          _weights(edges.size()) {
+        vector<atomic<uint64_t> > cursor(n_vertices);
+        parallel_for(edges.size(), [&](size_t e) {
+            cursor[edges[e].src].fetch_add(1, memory_order_relaxed);
+        });
+        for (uint32_t v = 0; v < n_vertices; v++) {
+            _offsets[v + 1] = _offsets[v] + cursor[v].load();
+            cursor[v].store(_offsets[v]);
+        }
+        parallel_for(edges.size(), [&](size_t e) {
+            uint64_t slot = cursor[edges[e].src].fetch_add(1, 
+                memory_order_relaxed);
+            _targets[slot] = edges[e].dst;
+            _weights[slot] = edges[e].weight;
+        });
+        // the scatter order is racy, so sort each list to make it canonical
+        parallel_for(n_vertices, [&](size_t v) {
+            sort_neighbours((uint32_t)v);
+        });
+    }
+
+    uint32_t num_vertices() const { return _offsets.size() - 1; }
+    uint64_t num_edges() const { return _targets.size(); }
+    uint64_t first_edge(uint32_t v) const { return _offsets[v]; }
+    uint64_t last_edge(uint32_t v) const { return _offsets[v + 1]; }
+    uint64_t degree(uint32_t v) const { return _offsets[v + 1] - _offsets[v]; }
+    uint32_t target(uint64_t e) const { return _targets[e]; }
+    float weight(uint64_t e) const { return _weights[e]; }
+
+private:
+    void sort_neighbours(uint32_t v) {
+        vector<pair<uint32_t, float> > list;
+        for (uint64_t e = first_edge(v); e < last_edge(v); e++)
+            list.emplace_back(_targets[e], _weights[e]);
+        sort(list.begin(), list.end());
+        for (uint64_t e = first_edge(v); e < last_edge(v); e++) {
+            _targets[e] = list[e - first_edge(v)].first;
+            _weights[e] = list[e - first_edge(v)].second;
+        }
+    }
+
+    vector<uint64_t> _offsets;
+    vector<uint32_t> _targets;
+    vector<float> _weights;
+};
+
+/**
+    The order of vertex IDs decides which vertices share cache lines. 
+    Relabelling vertices by descending degree packs the hubs, which nearly 
+    every traversal touches, into the first few cache lines of each per-vertex 
+    array. new_id maps an old ID to its new one, e.g. to relabel a BFS root.
+*/
+
+CsrGraph relabel_by_degree(const CsrGraph& g, vector<uint32_t>& new_id) {
+    vector<uint32_t> order(g.num_vertices());
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&g](uint32_t a, uint32_t b) {
+        return g.degree(a) > g.degree(b);
+    });
+    new_id.assign(g.num_vertices(), 0);
+    for (uint32_t i = 0; i < order.size(); i++)
+        new_id[order[i]] = i;
+    vector<Edge> edges(g.num_edges());
+    parallel_for(g.num_vertices(), [&](size_t v) {
+        for (uint64_t e = g.first_edge(v); e < g.last_edge(v); e++)
+            edges[e] = {new_id[v], new_id[g.target(e)], g.weight(e)};
+    });
+    return CsrGraph(g.num_vertices(), edges);
+}
+
+/**
+    Breadth-first search normally works top-down: each frontier vertex checks 
+    all its neighbours and claims the unvisited ones. On low-diameter graphs 
+    the frontier soon holds a large share of all vertices, and most of those 
+    checks find a neighbour that is already visited. Direction-optimising BFS 
+    (Beamer) switches to bottom-up steps for those middle levels: each 
+    unvisited vertex scans its own neighbours and stops at the first one in 
+    the frontier. The frontier is then held as a bitmap, one bit per vertex, 
+    so the membership test is a single load. The heuristic is to go bottom-up 
+    once the frontier's edges exceed 1/14 of the unexplored edges, and to 
+    return top-down once the frontier falls below 1/24 of the vertices.
+
+    Bottom-up steps follow in-edges, so the graph must be symmetric (each 
+    edge stored in both directions). It returns the BFS tree as parents.
+*/
+
+class Bitmap {
+public:
+    explicit Bitmap(size_t n) : _words((n + 63) / 64) {}
+    void set(uint32_t v) {
+        _words[v / 64].fetch_or(1ull << (v % 64), memory_order_relaxed);
+    }
+    bool test(uint32_t v) const {
+        return _words[v / 64].load(memory_order_relaxed) >> (v % 64) & 1;
+    }
+private:
+    vector<atomic<uint64_t> > _words;
+};
+
+vector<uint32_t> parallel_bfs(const CsrGraph& g, uint32_t root) {
+    const uint32_t n = g.num_vertices();
+    vector<atomic<uint32_t> > parent(n);
+    parallel_for(n, [&](size_t v) { parent[v].store(NO_VERTEX); });
+    parent[root].store(root);
+
+    size_t n_threads = max(1u, thread::hardware_concurrency());
+    vector<vector<uint32_t> > local(n_threads);
+    auto gather = [&local](vector<uint32_t>& out) {
+        out.clear();
+        for (vector<uint32_t>& part : local) {
+            out.insert(out.end(), part.begin(), part.end());
+            part.clear();
+        }
+    };
+
+    auto edges_of = [&g](const vector<uint32_t>& vertices) {
+        uint64_t edges = 0;
+        for (uint32_t v : vertices)
+            edges += g.degree(v);
+        return edges;
+    };
+
+    vector<uint32_t> frontier(1, root);
+    uint64_t unexplored_edges = g.num_edges();
+    while (!frontier.empty()) {
+        uint64_t frontier_edges = edges_of(frontier);
+        if (frontier_edges > unexplored_edges / 14) {
+            // bottom-up, until the frontier shrinks again
+            Bitmap current(n);
+            for (uint32_t v : frontier)
+                current.set(v);
+            size_t awake;
+            do {
+                // every layer explores its frontier's edges, not just the first
+                unexplored_edges -= min(unexplored_edges, edges_of(frontier));
+                Bitmap next(n);
+                parallel_ranges(n, [&](size_t tid, size_t lo, size_t hi) {
+                    for (size_t v = lo; v < hi; v++) {
+                        if (parent[v].load(memory_order_relaxed) != NO_VERTEX)
+                            continue;
+                        for (uint64_t e = g.first_edge(v); 
+                             e < g.last_edge(v); e++) {
+                            if (current.test(g.target(e))) {
+                                parent[v].store(g.target(e), 
+                                    memory_order_relaxed);
+                                next.set(v);
+                                local[tid].push_back(v);
+                                break;
+                            }
+                        }
+                    }
+                });
+                gather(frontier);
+                awake = frontier.size();
+                swap(current, next);
+            } while (awake > 0 && awake >= n / 24);
+        } else {
+            unexplored_edges -= min(unexplored_edges, frontier_edges);
+            parallel_ranges(frontier.size(), 
+                    [&](size_t tid, size_t lo, size_t hi) {
+                for (size_t i = lo; i < hi; i++) {
+                    uint32_t u = frontier[i];
+                    for (uint64_t e = g.first_edge(u); e < g.last_edge(u); 
+                         e++) {
+                        uint32_t v = g.target(e);
+                        uint32_t expected = NO_VERTEX;
+                        if (parent[v].load(memory_order_relaxed) == NO_VERTEX 
+                            && parent[v].compare_exchange_strong(expected, u))
+                            local[tid].push_back(v);
+                    }
+                }
+            });
+            gather(frontier);
+        }
+    }
+
+    vector<uint32_t> result(n);
+    parallel_for(n, [&](size_t v) { result[v] = parent[v].load(); });
+    return result;
+}
+
+/**
+    Dijkstra's algorithm settles one vertex at a time from a priority queue, 
+    which leaves nothing to run in parallel. Delta-stepping (Meyer and 
+    Sanders) relaxes the order: tentative distances are kept in buckets of 
+    width delta, and all vertices of the lowest non-empty bucket are processed 
+    together. Light edges (weight <= delta) may land back in the current 
+    bucket, so that bucket is repeated until it stays empty; heavy edges 
+    can only reach later buckets, so they are relaxed once at the end. A small 
+    delta approaches Dijkstra, a large one Bellman-Ford.
+*/
+
+vector<float> delta_stepping_sssp(const CsrGraph& g, uint32_t source, 
+                                  float delta) {
+    const float INF = numeric_limits<float>::infinity();
+    vector<atomic<float> > dist(g.num_vertices());
+    parallel_for(g.num_vertices(), [&](size_t v) { dist[v].store(INF); });
+    dist[source].store(0.0f);
+
+    size_t n_threads = max(1u, thread::hardware_concurrency());
+    vector<vector<uint32_t> > improved(n_threads);
+    vector<vector<uint32_t> > buckets(1, vector<uint32_t>(1, source));
+    auto bucket_of = [&](uint32_t v) {
+        return (size_t)(dist[v].load() / delta);
+    };
+
+    // relaxes the light or heavy edges of every vertex in from
+    auto relax = [&](const vector<uint32_t>& from, bool light) {
+        parallel_ranges(from.size(), [&](size_t tid, size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; i++) {
+                uint32_t u = from[i];
+                float du = dist[u].load(memory_order_relaxed);
+                for (uint64_t e = g.first_edge(u); e < g.last_edge(u); e++) {
+                    if ((g.weight(e) <= delta) != light)
+                        continue;
+                    uint32_t v = g.target(e);
+                    float d = du + g.weight(e);
+                    float old = dist[v].load(memory_order_relaxed);
+                    while (d < old) {
+                        if (dist[v].compare_exchange_weak(old, d)) {
+                            improved[tid].push_back(v);
+                            break;
+                        }
+                    }
+                }
+            }
+        });
+        for (vector<uint32_t>& part : improved) {
+            for (uint32_t v : part) {
+                if (bucket_of(v) >= buckets.size())
+                    buckets.resize(bucket_of(v) + 1);
+                buckets[bucket_of(v)].push_back(v);
+            }
+            part.clear();
+        }
+    };
+
+    for (size_t i = 0; i < buckets.size(); i++) {
+        vector<uint32_t> settled;
+        while (!buckets[i].empty()) {
+            vector<uint32_t> current;
+            // a vertex may have moved to an earlier bucket since it was added
+            for (uint32_t v : buckets[i])
+                if (bucket_of(v) == i)
+                    current.push_back(v);
+            buckets[i].clear();
+            settled.insert(settled.end(), current.begin(), current.end());
+            relax(current, true);
+        }
+        relax(settled, false);
+    }
+
+    vector<float> result(g.num_vertices());
+    parallel_for(g.num_vertices(), [&](size_t v) {
+        result[v] = dist[v].load();
+    });
+    return result;
+}
+
+/**
+    Graph algorithms are benchmarked in traversed edges per second (TEPS) on 
+    synthetic R-MAT graphs, as in Graph500. An R-MAT edge picks one quadrant 
+    of the adjacency matrix per bit of the vertex ID, with probabilities 
+    0.57, 0.19, 0.19 and 0.05, which gives the skewed degrees of real 
+    networks. Scale s means 2^s vertices and 16 * 2^s undirected edges, each 
+    stored in both directions.
+*/
+
+vector<Edge> rmat_edges(int scale, int edge_factor, uint64_t seed) {
+    vector<Edge> edges((size_t)edge_factor << scale << 1);
+    parallel_ranges(edges.size() / 2, [&](size_t tid, size_t lo, size_t hi) {
+        mt19937_64 rng(seed + tid);
+        uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        for (size_t i = lo; i < hi; i++) {
+            uint32_t src = 0, dst = 0;
+            for (int bit = 0; bit < scale; bit++) {
+                float r = uniform(rng);
+                src = src << 1 | (r >= 0.76f);
+                dst = dst << 1 | ((r >= 0.57f && r < 0.76f) || r >= 0.95f);
+            }
+            float weight = 1.0f - uniform(rng);
+            edges[2 * i] = {src, dst, weight};
+            edges[2 * i + 1] = {dst, src, weight};
+        }
+    });
+    return edges;
+}
+
+void graph_benchmark(int min_scale = 20, int max_scale = 26) {
+    for (int scale = min_scale; scale <= max_scale; scale++) {
+        auto start = chrono::steady_clock::now();
+        CsrGraph g(1u << scale, rmat_edges(scale, 16, scale));
+        chrono::duration<double> build = chrono::steady_clock::now() - start;
+        vector<uint32_t> new_id;
+        CsrGraph reordered = relabel_by_degree(g, new_id);
+
+        // edges traversed = directed edges leaving every reached vertex
+        auto teps = [](const CsrGraph& graph, uint32_t root, bool sssp) {
+            auto start = chrono::steady_clock::now();
+            uint64_t edges = 0;
+            if (sssp) {
+                vector<float> dist = delta_stepping_sssp(graph, root, 0.0625f);
+                for (uint32_t v = 0; v < graph.num_vertices(); v++)
+                    if (dist[v] != numeric_limits<float>::infinity())
+                        edges += graph.degree(v);
+            } else {
+                vector<uint32_t> parent = parallel_bfs(graph, root);
+                for (uint32_t v = 0; v < graph.num_vertices(); v++)
+                    if (parent[v] != NO_VERTEX)
+                        edges += graph.degree(v);
+            }
+            chrono::duration<double> t = chrono::steady_clock::now() - start;
+            return edges / t.count();
+        };
+
+        mt19937 rng(scale);
+        uint32_t root;
+        do
+            root = rng() % g.num_vertices();
+        while (g.degree(root) == 0);
+        cout << "scale " << scale << ": build " << build.count() << " s, BFS " 
+             << teps(g, root, false) << " TEPS (" 
+             << teps(reordered, new_id[root], false) << " reordered), SSSP " 
+             << teps(g, root, true) << " TEPS" << endl;
+    }
+}
+
+/**
+    The parallel versions are checked against the textbook ones on R-MAT 
+    graphs of a few scales, from several roots. parallel_bfs may return any 
+    BFS tree, so each parent must be a neighbour one level closer to the root 
+    than its child. Delta-stepping and Dijkstra take the minimum over the 
+    same float path sums, so their distances must match exactly, whatever 
+    delta. The relabelled graph must be the same graph under new_id.
+*/
+vector<uint32_t> sequential_bfs_levels(const CsrGraph& g, uint32_t root) {
+    vector<uint32_t> level(g.num_vertices(), NO_VERTEX);
+    vector<uint32_t> queue(1, root);
+    level[root] = 0;
+    for (size_t i = 0; i < queue.size(); i++) {
+        uint32_t u = queue[i];
+        for (uint64_t e = g.first_edge(u); e < g.last_edge(u); e++) {
+            if (level[g.target(e)] == NO_VERTEX) {
+                level[g.target(e)] = level[u] + 1;
+                queue.push_back(g.target(e));
+            }
+        }
+    }
+    return level;
+}
+
+vector<float> dijkstra(const CsrGraph& g, uint32_t source) {
+    vector<float> dist(g.num_vertices(), numeric_limits<float>::infinity());
+    priority_queue<pair<float, uint32_t>, vector<pair<float, uint32_t> >, 
+                   greater<pair<float, uint32_t> > > queue;
+    dist[source] = 0.0f;
+    queue.push({0.0f, source});
+    while (!queue.empty()) {
+        pair<float, uint32_t> top = queue.top();
+        queue.pop();
+        if (top.first > dist[top.second])
+            continue;  // stale, the vertex was settled at a shorter distance
+        uint32_t u = top.second;
+        for (uint64_t e = g.first_edge(u); e < g.last_edge(u); e++) {
+            float d = dist[u] + g.weight(e);
+            if (d < dist[g.target(e)]) {
+                dist[g.target(e)] = d;
+                queue.push({d, g.target(e)});
+            }
+        }
+    }
+    return dist;
+}
+
+bool is_bfs_tree(const CsrGraph& g, uint32_t root, 
+                 const vector<uint32_t>& parent) {
+    vector<uint32_t> level = sequential_bfs_levels(g, root);
+    if (parent[root] != root)
+        return false;
+    for (uint32_t v = 0; v < g.num_vertices(); v++) {
+        if ((parent[v] == NO_VERTEX) != (level[v] == NO_VERTEX))
+            return false;
+        if (v == root || parent[v] == NO_VERTEX)
+            continue;
+        uint32_t u = parent[v];
+        bool is_edge = false;
+        for (uint64_t e = g.first_edge(u); e < g.last_edge(u); e++)
+            is_edge |= g.target(e) == v;
+        if (level[u] + 1 != level[v] || !is_edge)
+            return false;
+    }
+    return true;
+}
+
+void test_graph() {
+    for (int scale : {6, 10, 14}) {
+        uint32_t n = 1u << scale;
+        vector<Edge> edges = rmat_edges(scale, 16, scale);
+        CsrGraph g(n, edges);
+
+        // each list holds exactly its source's edges, sorted
+        vector<vector<pair<uint32_t, float> > > lists(n);
+        for (const Edge& edge : edges)
+            lists[edge.src].emplace_back(edge.dst, edge.weight);
+        bool built = g.num_vertices() == n && g.num_edges() == edges.size();
+        for (uint32_t v = 0; v < n && built; v++) {
+            sort(lists[v].begin(), lists[v].end());
+            built &= g.degree(v) == lists[v].size();
+            for (uint64_t e = g.first_edge(v); e < g.last_edge(v) && built; 
+                 e++)
+                built &= g.target(e) == lists[v][e - g.first_edge(v)].first 
+                      && g.weight(e) == lists[v][e - g.first_edge(v)].second;
+        }
+        CHECK(built);
+
+        vector<uint32_t> new_id;
+        CsrGraph reordered = relabel_by_degree(g, new_id);
+        vector<bool> seen(n);
+        bool relabelled = reordered.num_edges() == g.num_edges();
+        for (uint32_t v = 0; v < n && relabelled; v++) {
+            relabelled &= new_id[v] < n && !seen[new_id[v]];
+            seen[new_id[v]] = true;
+            relabelled &= reordered.degree(new_id[v]) == g.degree(v);
+            if (v + 1 < n)
+                relabelled &= reordered.degree(v) >= reordered.degree(v + 1);
+        }
+        CHECK(relabelled);
+
+        mt19937 rng(scale);
+        for (int r = 0; r < 4; r++) {
+            uint32_t root = rng() % n;  // isolated roots too
+            CHECK(is_bfs_tree(g, root, parallel_bfs(g, root)));
+            CHECK(is_bfs_tree(reordered, new_id[root], 
+                              parallel_bfs(reordered, new_id[root])));
+
+            vector<float> expected = dijkstra(g, root);
+            for (float delta : {0.01f, 0.1f, 1.0f, 100.0f}) {
+                CHECK(delta_stepping_sssp(g, root, delta) == expected);
+                vector<float> dist = delta_stepping_sssp(reordered, 
+                                                         new_id[root], delta);
+                bool same = true;
+                for (uint32_t v = 0; v < n; v++)
+                    same &= dist[new_id[v]] == expected[v];
+                CHECK(same);
+            }
+        }
+    }
+}
+
+
+/** SEARCH, SORTING, ALGORITHMS AND COMPLEXITY
+
+    Searching algorithms depend on the chosen data structure involved, and may 
+    be much faster when the data has some order. Indeed, effort may be expended 
+    on insertion operations, such as in a binary tree, such that when it comes 
+    time to search, the cost is minimised.
+    
+    When dealing with an array, searching algorithms don't leave much to the 
+    imagination. If the array is not sorted, then only one deterministic 
+    algorithm exists--linear search, whereby all elements must be checked until 
+    the sought element is found, costing O(N/2) operations on average (1 in the 
+    best case, N in the worst). If the array is sorted, a binary search can be 
+    completed in at most O(log N) time.
+
+    Special data structures give no better search performance than an ordered 
+    array, unless an extra space cost is incurred. For example, a hash table 
+    supports O(1) search time, but the data structure must be much larger than 
+    the state space of keys.
+
+    Sorting algorithms are more interesting. These only make sense in the 
+    context of an unsorted array. The simplest/most naive algorithm is 
+    insertion sort. This moves along the array element-wise, and swaps an 
+    element backwards until it is locally sorted. Then the first part of the 
+    array is in order. Continuing assures the whole array is sorted. The 
+    algorithm runs in O(N^2) time on average, and at least O(N) (in the case 
+    the array is already sorted). Clearly, there are at most 1 + 2 + 3 + ... + 
+    N - 1 ~ N^2/2 swaps to make, in the even the array is sorted backwards.
+
+    A much better (and highly popular) sorting algorithm is quicksort. In this 
+    algorithm, a pivot element is chosen (say, the final element) and the other 
+    elements are shuffled/swapped such that all elements less than the pivot 
+    are to the left of the pivot, and those greater are on the right. The 
+    shuffling operation is O(N). The algorithm continues recursively, repeating 
+    this operation for the two unsorted halves, and so on, logN times, until 
+    the array is sorted. The algorithm runs on average in O(NlogN) time. The 
+    assumption is that the array is randomly sorted, so the pivot element has 
+    even chances of being the true median element. In the worst case, the 
+    algorithm runs in O(N^2) time. Heap sort is therefore theoretically 
+    superior, as it never performs worse than O(NlogN).
+
+    The radix sort algorithm, an inspired method, sorts elements in O(N) time, 
+    incurring a small memory overhead. This works by considering the digits (or 
+    characters) of elements in ascending order. Elements are funnelled to a 
+    series of bins based on this digit. Now the numbers are ordered with 
+    respect to the LSD. The may be return to the list. The operation is 
+    repeated for the second LSD. Now the numbers are ordered with respect to 
+    the second LSD, and wherever the same, ordered with respect to the first 
+    LSD to "break the tie", by virtue of the first round of sorting. This is 
+    repeated until MSD is sorted.
+
+        55 107 1 54 1000
+    =>  1000 1 54 55 107 ... position after funneling to buckets and returning 
+        to list.
+    =>  1000 01 107  54 55 ... note how 54 and 55, original inverted, retain 
+        the correct order after the first iteration
+    =>  1000 001 054 055 107  ... missing digits are treated as zeros
+    =>  0001 0054 0055 0107 1000 ... and sorting is complete
+
+    We thus require O(N) memory for the array, and O(kN) memory for the bins, 
+    which are recycled, where k is the maximum number of digits. The time 
+    complexity is O(kN).
+*/
+
+
+/** PROBABILISTIC MEMBERSHIP FILTERS
+
+    The "extra space cost" above can also be small and bounded if we accept 
+    being wrong sometimes. A membership filter answers "definitely not present" 
+    or "possibly present", so it sits in front of an expensive lookup (a disk 
+    read, a B-tree descent) and skips the lookup whenever the answer is no. 
+    When most queries miss, most lookups are skipped. The false-positive rate 
+    depends only on the bits spent per key, not on the size of the keys.
+
+    A Bloom filter sets k bits per key in a bit array and reports a key as 
+    present if all k bits are set. The classic version scatters the k bits 
+    over the whole array, costing k cache misses per query. A blocked Bloom 
+    filter first hashes the key to one 64-byte block (one cache line), and 
+    sets all k = 8 bits inside it, one per 64-bit word. Each bit position is 
+    the top 6 bits of the hash multiplied by a different odd constant, so the 
+    eight lanes are independent and branch-free, and an out-of-order core 
+    runs them side by side. They are not vectorised: GCC 12 keeps the loops 
+    scalar even at -O3 -mavx2, though AVX2 has both the eight 32-bit 
+    multiplies and the per-lane 64-bit shifts. The block's cache miss costs 
+    more than the arithmetic anyway, and contains_batch overlaps those. The 
+    price of blocking is a slightly higher false-positive rate than unblocked 
+    at the same bits per key.
+*/
+
+// MurmurHash3's 64-bit finaliser; every input bit affects every output bit
+inline uint64_t hash64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+class BlockedBloomFilter {
+public:
+    BlockedBloomFilter(size_t n_keys, double bits_per_key)
+        : _blocks(max<size_t>(1, n_keys * bits_per_key / 512)) {}
+
+    // bulk build
+    BlockedBloomFilter(const vector<uint64_t>& keys, double bits_per_key)
+        : BlockedBloomFilter(keys.size(), bits_per_key) {
+        for (uint64_t key : keys)
+            insert(key);
+    }
+
+    void insert(uint64_t key) {
+        uint64_t h = hash64(key);
+        uint64_t mask[8];
+        make_mask(h, mask);
+        Block& block = _blocks[block_index(h)];
+        for (int i = 0; i < 8; i++)
+            block.words[i] |= mask[i];
+    }
+
+    bool contains(uint64_t key) const {
+        uint64_t h = hash64(key);
+        return block_contains(_blocks[block_index(h)], h);
+    }
+
+    /**
+        Queries a batch in groups: hash a group and prefetch its blocks, then 
+        test them, so the cache misses of a group overlap rather than queue.
+    */
+    void contains_batch(const uint64_t* keys, size_t n, bool* out) const {
+        const size_t GROUP = 16;
+        uint64_t h[GROUP];
+        for (size_t lo = 0; lo < n; lo += GROUP) {
+            size_t m = min(GROUP, n - lo);
+            for (size_t i = 0; i < m; i++) {
+                h[i] = hash64(keys[lo + i]);
+                __builtin_prefetch(&_blocks[block_index(h[i])]);
+            }
+            for (size_t i = 0; i < m; i++)
+                out[lo + i] = block_contains(_blocks[block_index(h[i])], h[i]);
+        }
+    }
+
+    size_t size_in_bits() const { return _blocks.size() * 512; }
+
+private:
+    struct alignas(64) Block {
+        uint64_t words[8] = {};
+    };
+
+    // the high half picks the block, without a modulo
+    size_t block_index(uint64_t h) const {
+        return (h >> 32) * _blocks.size() >> 32;
+    }
+
+    // the low half picks one bit in each of the eight words
+    static void make_mask(uint64_t h, uint64_t mask[8]) {
+        static const uint32_t SALT[8] = {
+            0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU, 
+            0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+        };
+        for (int i = 0; i < 8; i++)
+            mask[i] = 1ULL << ((uint32_t)h * SALT[i] >> 26);
+    }
+
+    // no early exit, so the loop stays branch-free
+    static bool block_contains(const Block& block, uint64_t h) {
+        uint64_t mask[8];
+        make_mask(h, mask);
+        uint64_t missing = 0;
+        for (int i = 0; i < 8; i++)
+            missing |= mask[i] & ~block.words[i];
+        return missing == 0;
+    }
+
+    vector<Block> _blocks;
+};
+
+/**
+    A Bloom filter cannot delete, since a bit may be shared by several keys. 
+    A quotient filter (Bender et al.) stores a p-bit fingerprint of each key 
+    instead, which it can remove again. The top q bits of the fingerprint 
+    (the quotient) choose a slot of a 2^q slot table and the remaining r bits 
+    (the remainder) are stored. Keys with the same quotient form a run of 
+    adjacent slots, and when a slot is taken the run is shifted right, as in 
+    linear probing. Three bits per slot let the runs be reconstructed:
+
+        occupied     - some key has this slot as its quotient
+        continuation - this slot continues the run of the slot before
+        shifted      - this remainder is not in its quotient's slot
+
+    Runs that touch form a cluster, which starts at an unshifted slot and ends 
+    at an empty one. Here a slot is 16 bits: a 13-bit remainder and the three 
+    flags. A false positive needs the same quotient and remainder, so the rate 
+    is about load * 2^-13. Duplicates are kept, so a key inserted twice must 
+    be erased twice, as in a counting filter. Only erase inserted keys, or 
+    another key that shares the fingerprint is removed.
+*/
+
+class QuotientFilter {
+public:
+    explicit QuotientFilter(int q_bits)
+        : _mask((1ULL << q_bits) - 1), _slots(1ULL << q_bits), _size(0) {}
+
+    /**
+        Bulk build: in sorted fingerprint order each key belongs at the end of 
+        the last cluster, so it is written in place without decoding one. Only 
+        a cluster that wraps past the end of the table takes the slow path.
+    */
+    QuotientFilter(const vector<uint64_t>& keys, int q_bits)
+        : QuotientFilter(q_bits) {
+        if (keys.size() > _slots.size() * 0.95)
+            throw invalid_argument("too many keys for the quotient filter");
+        vector<pair<uint64_t, uint16_t> > entries;
+        entries.reserve(keys.size());
+        for (uint64_t key : keys) {
+            uint64_t q, r;
+            fingerprint(key, q, r);
+            entries.emplace_back(q, (uint16_t)r);
+        }
+        sort(entries.begin(), entries.end());
+        uint64_t end = 0;  // every slot from here on is empty
+        for (const auto& entry : entries) {
+            uint64_t q = entry.first, s = max(q, end);
+            if (s >= _slots.size()) {
+                insert_fingerprint(q, entry.second);
+                continue;
+            }
+            uint16_t flags = s == q ? 0 : SHIFTED;
+            if (_slots[q] & OCCUPIED)
+                flags |= CONTINUATION;  // q's run is the last one so far
+            _slots[q] |= OCCUPIED;
+            _slots[s] = (_slots[s] & OCCUPIED) | flags | entry.second;
+            _size++;
+            end = s + 1;
+        }
+    }
+
+    // returns false if the table is too full to insert into
+    bool insert(uint64_t key) {
+        if (_size + 1 > _slots.size() * 0.95)
+            return false;
+        uint64_t q, r;
+        fingerprint(key, q, r);
+        insert_fingerprint(q, r);
+        return true;
+    }
+
+    bool contains(uint64_t key) const {
+        uint64_t q, r;
+        fingerprint(key, q, r);
+        return contains_fingerprint(q, r);
+    }
+
+    // as BlockedBloomFilter::contains_batch, prefetching each home slot
+    void contains_batch(const uint64_t* keys, size_t n, bool* out) const {
+        const size_t GROUP = 16;
+        uint64_t q[GROUP], r[GROUP];
+        for (size_t lo = 0; lo < n; lo += GROUP) {
+            size_t m = min(GROUP, n - lo);
+            for (size_t i = 0; i < m; i++) {
+                fingerprint(keys[lo + i], q[i], r[i]);
+                __builtin_prefetch(&_slots[q[i]]);
+            }
+            for (size_t i = 0; i < m; i++)
+                out[lo + i] = contains_fingerprint(q[i], r[i]);
+        }
+    }
+
+    bool erase(uint64_t key) {
+        uint64_t q, r;
+        fingerprint(key, q, r);
+        if (!(_slots[q] & OCCUPIED))
+            return false;
+        uint64_t start = cluster_start(q);
+        vector<pair<uint64_t, uint16_t> > entries;
+        decode(start, entries);
+        auto it = find(entries.begin(), entries.end(), 
+                       make_pair(q, (uint16_t)r));
+        if (it == entries.end())
+            return false;
+        clear(start, entries.size());
+        entries.erase(it);
+        bool run_left = false;
+        for (const auto& entry : entries)
+            run_left |= entry.first == q;
+        if (!run_left)
+            _slots[q] &= ~OCCUPIED;
+        encode(start, entries);
+        _size--;
+        return true;
+    }
+
+    size_t size() const { return _size; }
+    size_t size_in_bits() const { return _slots.size() * 16; }
+
+private:
+    static const int R_BITS = 13;
+    static const uint16_t REMAINDER = (1 << R_BITS) - 1;
+    static const uint16_t OCCUPIED = 1 << 13;
+    static const uint16_t CONTINUATION = 1 << 14;
+    static const uint16_t SHIFTED = 1 << 15;
+
+    void insert_fingerprint(uint64_t q, uint64_t r) {
+        uint64_t start = cluster_start(q);
+        vector<pair<uint64_t, uint16_t> > entries;
+        decode(start, entries);
+        clear(start, entries.size());
+        // append to the end of q's run, keeping runs in quotient order
+        size_t i = 0;
+        while (i < entries.size() && distance(start, entries[i].first) <= 
+                                     distance(start, q))
+            i++;
+        entries.insert(entries.begin() + i, make_pair(q, (uint16_t)r));
+        _slots[q] |= OCCUPIED;
+        encode(start, entries);
+        _size++;
+    }
+
+    bool contains_fingerprint(uint64_t q, uint64_t r) const {
+        if (!(_slots[q] & OCCUPIED))
+            return false;
+        // find where q's run starts by counting runs from the cluster start
+        uint64_t b = cluster_start(q), s = b;
+        while (b != q) {
+            do
+                s = next(s);
+            while (_slots[s] & CONTINUATION);
+            do
+                b = next(b);
+            while (!(_slots[b] & OCCUPIED));
+        }
+        do {
+            if ((_slots[s] & REMAINDER) == r)
+                return true;
+            s = next(s);
+        } while (_slots[s] & CONTINUATION);
+        return false;
+    }
+
+    void fingerprint(uint64_t key, uint64_t& q, uint64_t& r) const {
+        uint64_t h = hash64(key);
+        q = (h >> R_BITS) & _mask;
+        r = h & REMAINDER;
+    }
+
+    uint64_t next(uint64_t i) const { return (i + 1) & _mask; }
+    uint64_t prev(uint64_t i) const { return (i - 1) & _mask; }
+    uint64_t distance(uint64_t from, uint64_t to) const {
+        return (to - from) & _mask;
+    }
+    bool is_empty(uint64_t i) const {
+        return !(_slots[i] & (OCCUPIED | CONTINUATION | SHIFTED));
+    }
+
+    uint64_t cluster_start(uint64_t q) const {
+        while (_slots[q] & SHIFTED)
+            q = prev(q);
+        return q;
+    }
+
+    /**
+        Insert and erase rebuild the slots from the cluster start up to the 
+        next empty slot: decode them to (quotient, remainder) pairs, edit the 
+        list, and encode it back. This is simpler than shifting in place and 
+        costs the same, as in-place shifting also touches every slot there.
+    */
+    void decode(uint64_t start, vector<pair<uint64_t, uint16_t> >& entries) {
+        uint64_t b = start;
+        for (uint64_t s = start; !is_empty(s); s = next(s)) {
+            if (s != start && !(_slots[s] & CONTINUATION)) {
+                do
+                    b = next(b);
+                while (!(_slots[b] & OCCUPIED));
+            }
+            entries.emplace_back(b, _slots[s] & REMAINDER);
+        }
+    }
+
+    // clears everything but the occupied bits, which belong to the quotient
+    void clear(uint64_t start, size_t n) {
+        for (size_t i = 0; i < n; i++, start = next(start))
+            _slots[start] &= OCCUPIED;
+    }
+
+    void encode(uint64_t start, 
+                const vector<pair<uint64_t, uint16_t> >& entries) {
+        uint64_t pos = 0;
+        for (size_t i = 0; i < entries.size(); i++) {
+            uint64_t q = entries[i].first;
+            uint16_t flags = CONTINUATION | SHIFTED;
+            if (i == 0 || q != entries[i - 1].first) {
+                pos = max(pos, distance(start, q));
+                flags = pos == distance(start, q) ? 0 : SHIFTED;
+            }
+            uint64_t s = (start + pos++) & _mask;
+            _slots[s] = (_slots[s] & OCCUPIED) | flags | entries[i].second;
+        }
+    }
+
+    uint64_t _mask;
+    vector<uint16_t> _slots;
+    size_t _size;
+};
+
+/**
+    The benchmark puts each filter in front of a binary search over a sorted 
+    array, standing in for a disk or B-tree lookup, with 95% of queries 
+    missing. It reports the measured false-positive rate for each bits-per-key 
+    setting, and queries per second with and without the filter.
+*/
+
+void filter_benchmark() {
+    const size_t N = 1 << 22;
+    mt19937_64 rng(42);
+    // members have the low bit clear, misses have it set
+    vector<uint64_t> keys(N), queries(N), misses(N);
+    for (size_t i = 0; i < N; i++) {
+        keys[i] = rng() & ~1ULL;
+        misses[i] = rng() | 1;
+        queries[i] = rng() % 100 < 5 ? keys[rng() % N] : misses[i];
+    }
+    vector<uint64_t> sorted(keys);
+    sort(sorted.begin(), sorted.end());
+    unique_ptr<bool[]> maybe(new bool[N]);
+
+    auto queries_per_sec = [&](auto filter_batch) {
+        auto start = chrono::steady_clock::now();
+        filter_batch(queries.data(), N, maybe.get());
+        size_t found = 0;
+        for (size_t i = 0; i < N; i++)
+            if (maybe[i])
+                found += binary_search(sorted.begin(), sorted.end(), 
+                                       queries[i]);
+        chrono::duration<double> t = chrono::steady_clock::now() - start;
+        do_not_optimize(found);
+        return N / t.count();
+    };
+    auto fp_rate = [&](auto filter_batch) {
+        filter_batch(misses.data(), N, maybe.get());
+        return count(maybe.get(), maybe.get() + N, true) / (double)N;
+    };
+
+    auto no_filter = [](const uint64_t*, size_t n, bool* out) {
+        fill(out, out + n, true);
+    };
+    cout << "unfiltered: " << queries_per_sec(no_filter) << " q/s" << endl;
+
+    for (double bits_per_key : {4, 6, 8, 10, 12, 16}) {
+        BlockedBloomFilter bloom(keys, bits_per_key);
+        auto batch = [&bloom](const uint64_t* k, size_t n, bool* out) {
+            bloom.contains_batch(k, n, out);
+        };
+        cout << "blocked Bloom, " << bits_per_key << " bits/key: FPR " 
+             << fp_rate(batch) << ", " << queries_per_sec(batch) << " q/s" 
+             << endl;
+    }
+
+    QuotientFilter quotient(keys, 23);
+    auto batch = [&quotient](const uint64_t* k, size_t n, bool* out) {
+        quotient.contains_batch(k, n, out);
+    };
+    cout << "quotient, " << quotient.size_in_bits() / (double)N 
+         << " bits/key: FPR " << fp_rate(batch) << ", " 
+         << queries_per_sec(batch) << " q/s" << endl;
+}
+
+/**
+    A filter may say yes to a key it never saw, but never no to one it holds, 
+    so each filter is checked for false negatives through every query path. 
+    The quotient filter is also run against a model, a count per key, with 
+    random inserts and erases in a small table kept nearly full, so clusters 
+    are long and wrap past the end. Its bulk build must agree with inserting 
+    the keys one at a time.
+*/
+void test_filters() {
+    mt19937_64 rng(11);
+    vector<uint64_t> keys(20000), misses(20000);
+    for (size_t i = 0; i < keys.size(); i++) {
+        keys[i] = rng() & ~1ULL;
+        misses[i] = rng() | 1;
+    }
+    unique_ptr<bool[]> out(new bool[keys.size()]);
+
+    BlockedBloomFilter bloom(keys, 10);
+    size_t bloom_missing = 0, bloom_fp = 0;
+    bloom.contains_batch(keys.data(), keys.size(), out.get());
+    for (size_t i = 0; i < keys.size(); i++)
+        bloom_missing += !bloom.contains(keys[i]) + !out[i];
+    bloom.contains_batch(misses.data(), misses.size(), out.get());
+    for (size_t i = 0; i < misses.size(); i++) {
+        CHECK(out[i] == bloom.contains(misses[i]));
+        bloom_fp += out[i];
+    }
+    CHECK(bloom_missing == 0);
+    CHECK(bloom_fp < misses.size() / 50);  // about 1% at 10 bits per key
+
+    // a quarter duplicates, which must be kept and erased once each
+    vector<uint64_t> dup_keys(keys.begin(), keys.begin() + 15000);
+    dup_keys.insert(dup_keys.end(), keys.begin(), keys.begin() + 5000);
+    QuotientFilter bulk(dup_keys, 15), one_by_one(15);
+    for (uint64_t key : dup_keys)
+        CHECK(one_by_one.insert(key));
+    CHECK(bulk.size() == dup_keys.size());
+    size_t qf_missing = 0, disagree = 0;
+    bulk.contains_batch(keys.data(), keys.size(), out.get());
+    for (size_t i = 0; i < 15000; i++)
+        qf_missing += !bulk.contains(keys[i]) + !out[i];
+    bulk.contains_batch(misses.data(), misses.size(), out.get());
+    for (size_t i = 0; i < misses.size(); i++)
+        disagree += out[i] != one_by_one.contains(misses[i]);
+    CHECK(qf_missing == 0);
+    CHECK(disagree == 0);
+    size_t erased = 0;
+    for (uint64_t key : dup_keys)
+        erased += bulk.erase(key);
+    CHECK(erased == dup_keys.size() && bulk.size() == 0);
+    bulk.contains_batch(keys.data(), keys.size(), out.get());
+    CHECK(count(out.get(), out.get() + keys.size(), true) == 0);
+
+    // tiny and nearly full, so the last cluster wraps past the end
+    for (size_t lo = 0; lo + 60 <= keys.size(); lo += 60) {
+        vector<uint64_t> few(keys.begin() + lo, keys.begin() + lo + 60);
+        QuotientFilter tiny_bulk(few, 6), tiny(6);
+        for (uint64_t key : few)
+            tiny.insert(key);
+        for (size_t i = 0; i < 60; i++) {
+            qf_missing += !tiny_bulk.contains(few[i]);
+            disagree += tiny_bulk.contains(misses[lo + i]) != 
+                        tiny.contains(misses[lo + i]);
+        }
+    }
+    CHECK(qf_missing == 0);
+    CHECK(disagree == 0);
+
+    QuotientFilter filter(10);
+    unordered_map<uint64_t, int> model;
+    vector<uint64_t> pool(keys.begin(), keys.begin() + 1200);
+    size_t model_size = 0, mismatches = 0, false_positives = 0;
+    for (int op = 0; op < 200000; op++) {
+        uint64_t key = pool[rng() % pool.size()];
+        int& n = model[key];
+        if (rng() % 2 == 0) {
+            bool inserted = filter.insert(key);
+            // it refuses only above 95% load
+            mismatches += inserted != (model_size + 1 <= 1024 * 0.95);
+            n += inserted;
+            model_size += inserted;
+        } else if (n > 0) {
+            mismatches += !filter.erase(key);
+            n--;
+            model_size--;
+        }
+        if (n > 0)
+            mismatches += !filter.contains(key);
+        else
+            false_positives += filter.contains(key);
+        mismatches += filter.size() != model_size;
+    }
+    for (const auto& entry : model)
+        mismatches += entry.second > 0 && !filter.contains(entry.first);
+    CHECK(mismatches == 0);
+    CHECK(false_positives < 100);  // about one miss in 8192 of these
+}
+
+/** VON NEUMANN ARCHITECTURE
+
+    The von Neumann architecture is a conceptual design for a computer 
+    architecture by John von Neumann in 1945. It consists of input and output 
+    to a computer consisting of a CPU and memory. The CPU further consists of 
+    a control unit and arithmetic/logic unit.
+*/
+
+
+/** WHAT IS A BUS/BUSS?
+
+    A system bus is hardware providing a communication channel between hardware 
+    components.
+*/
+
+
+/** WHAT IS x86?
+
+    x86 refers to a family (hence the 'x') of 32-bit processors by Intel. x64 
+    is the family of 64-bit processors, which can for example directly 
+    reference memory addresses of size 2^64.
+*/
+
+
+/** RUNTIME CPU DISPATCH
+
+    Each generation of x64 processors adds wider vector instructions: SSE4.2 
+    works on 16 bytes at a time, AVX2 on 32, AVX-512 on 64. A binary compiled 
+    for the newest generation crashes on older ones, so a fleet of mixed 
+    machines is usually built for the oldest and never uses the wider units. 
+    Runtime dispatch applies the late binding idea of shared libraries to 
+    single functions: the binary contains one version of each hot kernel per 
+    instruction set, and picks among them once at startup by asking the CPU 
+    (the cpuid instruction) what it supports.
+
+    GCC compiles a function for a given instruction set with 
+    __attribute__((target("avx2"))), regardless of the flags of the rest of 
+    the file, and __builtin_cpu_supports("avx2") performs the check (it also 
+    verifies the OS saves the wider registers). The choice is made once and 
+    stored in a table of function pointers, a static local so that it is 
+    initialised exactly once, even with several threads. The loader's 
+    equivalent is the ifunc resolver, which patches the choice into the 
+    dynamic symbol table itself, but it is specific to ELF and glibc.
+
+    The vector versions use intrinsics from <immintrin.h>, functions that map 
+    one-to-one to instructions. Where a kernel has no useful vector form, like 
+    the radix sort histogram whose increments depend on each other, the same 
+    loop is compiled once per target and the compiler's scheduling is all that 
+    differs.
+*/
+
+#include <immintrin.h>
+#include <cstdint>
+
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 \
+    __attribute__((target("avx512f,avx512bw,avx512dq,avx512vl")))
+
+enum IsaLevel {ISA_SCALAR, ISA_SSE42, ISA_AVX2, ISA_AVX512};
+
+const char* const ISA_NAMES[] = {"scalar", "SSE4.2", "AVX2", "AVX-512"};
+
+struct MinMaxSum {
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+};
+
+// Finishes a min/max/sum over the elements a vector loop left over
+inline MinMaxSum min_max_sum_tail(MinMaxSum r, const int32_t* a, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        r.min = min(r.min, a[i]);
+        r.max = max(r.max, a[i]);
+        r.sum += a[i];
+    }
+    return r;
+}
+
+MinMaxSum min_max_sum_scalar(const int32_t* a, size_t n) {
+    MinMaxSum r = {INT32_MAX, INT32_MIN, 0};
+    return min_max_sum_tail(r, a, n);
+}
+
+TARGET_SSE42 MinMaxSum min_max_sum_sse42(const int32_t* a, size_t n) {
+    __m128i lo = _mm_set1_epi32(INT32_MAX), hi = _mm_set1_epi32(INT32_MIN);
+    __m128i sum = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(a + i));
+        lo = _mm_min_epi32(lo, v);
+        hi = _mm_max_epi32(hi, v);
+        // widen to 64 bits before adding, so the sum cannot overflow
+        sum = _mm_add_epi64(sum, _mm_cvtepi32_epi64(v));
+        sum = _mm_add_epi64(sum, _mm_cvtepi32_epi64(_mm_srli_si128(v, 8)));
+    }
+    int32_t los[4], his[4];
+    int64_t sums[2];
+    _mm_storeu_si128((__m128i*)los, lo);
+    _mm_storeu_si128((__m128i*)his, hi);
+    _mm_storeu_si128((__m128i*)sums, sum);
+    MinMaxSum r = {INT32_MAX, INT32_MIN, sums[0] + sums[1]};
+    for (int j = 0; j < 4; j++) {
+        r.min = min(r.min, los[j]);
+        r.max = max(r.max, his[j]);
+    }
+    return min_max_sum_tail(r, a + i, n - i);
+}
+
+TARGET_AVX2 MinMaxSum min_max_sum_avx2(const int32_t* a, size_t n) {
+    __m256i lo = _mm256_set1_epi32(INT32_MAX);
+    __m256i hi = _mm256_set1_epi32(INT32_MIN);
+    __m256i sum = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(a + i));
+        lo = _mm256_min_epi32(lo, v);
+        hi = _mm256_max_epi32(hi, v);
+        sum = _mm256_add_epi64(sum, 
+            _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+        sum = _mm256_add_epi64(sum, 
+            _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+    }
+    int32_t los[8], his[8];
+    int64_t sums[4];
+    _mm256_storeu_si256((__m256i*)los, lo);
+    _mm256_storeu_si256((__m256i*)his, hi);
+    _mm256_storeu_si256((__m256i*)sums, sum);
+    MinMaxSum r = {INT32_MAX, INT32_MIN, sums[0] + sums[1] + sums[2] + sums[3]};
+    for (int j = 0; j < 8; j++) {
+        r.min = min(r.min, los[j]);
+        r.max = max(r.max, his[j]);
+    }
+    return min_max_sum_tail(r, a + i, n - i);
+}
+
+/**
+    Many of GCC 12's AVX-512 intrinsics start from a deliberately undefined 
+    register, which -Wall reports as an uninitialised variable in the 
+    compiler's own headers. The AVX-512 kernels therefore use GCC's vector 
+    extensions instead: vector types with the usual operators, which the 
+    compiler turns into the same instructions for the function's target.
+*/
+typedef int32_t Int32x8 __attribute__((vector_size(32)));
+typedef int64_t Int64x4 __attribute__((vector_size(32)));
+typedef int32_t Int32x16 __attribute__((vector_size(64)));
+typedef int64_t Int64x8 __attribute__((vector_size(64)));
+typedef uint64_t Uint64x8 __attribute__((vector_size(64)));
+
+TARGET_AVX512 MinMaxSum min_max_sum_avx512(const int32_t* a, size_t n) {
+    Int32x16 lo = Int32x16{} + INT32_MAX, hi = Int32x16{} + INT32_MIN;
+    Int64x8 sum = {};
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        Int32x16 v;
+        memcpy(&v, a + i, sizeof(v));
+        lo = v < lo ? v : lo;
+        hi = v > hi ? v : hi;
+        sum += __builtin_convertvector(
+            __builtin_shufflevector(v, v, 0, 1, 2, 3, 4, 5, 6, 7), Int64x8);
+        sum += __builtin_convertvector(
+            __builtin_shufflevector(v, v, 8, 9, 10, 11, 12, 13, 14, 15), 
+            Int64x8);
+    }
+    MinMaxSum r = {INT32_MAX, INT32_MIN, 0};
+    for (int j = 0; j < 16; j++) {
+        r.min = min(r.min, lo[j]);
+        r.max = max(r.max, hi[j]);
+    }
+    for (int j = 0; j < 8; j++)
+        r.sum += sum[j];
+    return min_max_sum_tail(r, a + i, n - i);
+}
+
+// memchr: a pointer to the first c in s[0, n), or nullptr
+const char* find_byte_scalar(const char* s, size_t n, char c) {
+    for (size_t i = 0; i < n; i++)
+        if (s[i] == c)
+            return s + i;
+    return nullptr;
+}
+
+TARGET_SSE42 const char* find_byte_sse42(const char* s, size_t n, char c) {
+    __m128i needle = _mm_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        // one bit per byte that matched
+        int hits = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+        if (hits)
+            return s + i + __builtin_ctz(hits);
+    }
+    return find_byte_scalar(s + i, n - i, c);
+}
+
+TARGET_AVX2 const char* find_byte_avx2(const char* s, size_t n, char c) {
+    __m256i needle = _mm256_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+        unsigned hits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+        if (hits)
+            return s + i + __builtin_ctz(hits);
+    }
+    return find_byte_scalar(s + i, n - i, c);
+}
+
+TARGET_AVX512 const char* find_byte_avx512(const char* s, size_t n, char c) {
+    __m512i needle = _mm512_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m512i v = _mm512_loadu_si512(s + i);
+        uint64_t hits = _mm512_cmpeq_epi8_mask(v, needle);
+        if (hits)
+            return s + i + __builtin_ctzll(hits);
+    }
+    return find_byte_scalar(s + i, n - i, c);
+}
+
+/**
+    Counts one radix sort digit (the byte at shift) of each key. Keys with the 
+    same digit back to back would wait on each other's increment, so four 
+    tables are counted in turn and summed at the end.
+*/
+inline __attribute__((always_inline)) void radix_histogram_body(
+        const uint32_t* keys, size_t n, int shift, uint32_t counts[256]) {
+    uint32_t tables[4][256] = {};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        for (int j = 0; j < 4; j++)
+            tables[j][keys[i + j] >> shift & 0xff]++;
+    for (; i < n; i++)
+        tables[0][keys[i] >> shift & 0xff]++;
+    for (int d = 0; d < 256; d++)
+        counts[d] = tables[0][d] + tables[1][d] + tables[2][d] + tables[3][d];
+}
+
+void radix_histogram_scalar(const uint32_t* keys, size_t n, int shift, 
+                            uint32_t counts[256]) {
+    radix_histogram_body(keys, n, shift, counts);
+}
+
+TARGET_SSE42 void radix_histogram_sse42(const uint32_t* keys, size_t n, 
+                                        int shift, uint32_t counts[256]) {
+    radix_histogram_body(keys, n, shift, counts);
+}
+
+TARGET_AVX2 void radix_histogram_avx2(const uint32_t* keys, size_t n, 
+                                      int shift, uint32_t counts[256]) {
+    radix_histogram_body(keys, n, shift, counts);
+}
+
+TARGET_AVX512 void radix_histogram_avx512(const uint32_t* keys, size_t n, 
+                                          int shift, uint32_t counts[256]) {
+    radix_histogram_body(keys, n, shift, counts);
+}
+
+/**
+    Hashes each key with hash64 (above). The multiplies are 64-bit, which only 
+    AVX-512 (DQ) has as a vector instruction; AVX2 builds each one from three 
+    32-bit multiplies, and SSE4.2 has nothing better than the scalar loop.
+*/
+void hash_keys_scalar(const uint64_t* keys, size_t n, uint64_t* out) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = hash64(keys[i]);
+}
+
+TARGET_AVX2 inline __m256i mullo64_avx2(__m256i a, __m256i b) {
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(
+        _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), 
+        _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+TARGET_AVX2 void hash_keys_avx2(const uint64_t* keys, size_t n, 
+                                uint64_t* out) {
+    const __m256i m1 = _mm256_set1_epi64x(0xff51afd7ed558ccdULL);
+    const __m256i m2 = _mm256_set1_epi64x(0xc4ceb9fe1a85ec53ULL);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(keys + i));
+        x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 33));
+        x = mullo64_avx2(x, m1);
+        x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 33));
+        x = mullo64_avx2(x, m2);
+        x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 33));
+        _mm256_storeu_si256((__m256i*)(out + i), x);
+    }
+    hash_keys_scalar(keys + i, n - i, out + i);
+}
+
+TARGET_AVX512 void hash_keys_avx512(const uint64_t* keys, size_t n, 
+                                    uint64_t* out) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        Uint64x8 x;
+        memcpy(&x, keys + i, sizeof(x));
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        memcpy(out + i, &x, sizeof(x));
+    }
+    hash_keys_scalar(keys + i, n - i, out + i);
+}
+
+struct KernelTable {
+    MinMaxSum (*min_max_sum)(const int32_t* a, size_t n);
+    const char* (*find_byte)(const char* s, size_t n, char c);
+    void (*radix_histogram)(const uint32_t* keys, size_t n, int shift, 
+                            uint32_t counts[256]);
+    void (*hash_keys)(const uint64_t* keys, size_t n, uint64_t* out);
+};
+
+IsaLevel detect_isa_level() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx512dq") 
+        && __builtin_cpu_supports("avx512vl"))
+        return ISA_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return ISA_AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return ISA_SSE42;
+    return ISA_SCALAR;
+}
+
+// Any level up to detect_isa_level() may be forced, e.g. for testing
+const KernelTable& kernel_table(IsaLevel level) {
+    static const KernelTable TABLES[] = {
+        {min_max_sum_scalar, find_byte_scalar, radix_histogram_scalar, 
+         hash_keys_scalar},
+        {min_max_sum_sse42, find_byte_sse42, radix_histogram_sse42, 
+         hash_keys_scalar},
+        {min_max_sum_avx2, find_byte_avx2, radix_histogram_avx2, 
+         hash_keys_avx2},
+        {min_max_sum_avx512, find_byte_avx512, radix_histogram_avx512, 
+         hash_keys_avx512}
+    };
+    return TABLES[level];
+}
+
+// The kernels for this machine, chosen on first use
+const KernelTable& kernels() {
+    static const KernelTable& table = kernel_table(detect_isa_level());
+    return table;
+}
+
+/**
+    Every path this machine supports must agree with the scalar one, 
+    including on lengths that leave a tail for the scalar loop, and kernels() 
+    must have picked the best of them. find_byte is also tried with its only 
+    match at every position of strings up to three AVX-512 vectors long, 
+    which covers index 0, each lane boundary and the tail. It runs from main, 
+    at the end of the file.
+*/
+void test_kernel_dispatch() {
+    mt19937_64 rng(1);
+    vector<int32_t> ints(1000);
+    vector<uint32_t> keys(1000);
+    vector<uint64_t> wide(1000), hashes(1000), expected_hashes(1000);
+    string text(1000, 'a');
+    for (size_t i = 0; i < 1000; i++) {
+        ints[i] = (int32_t)rng();
+        keys[i] = (uint32_t)rng();
+        wide[i] = rng();
+    }
+    text[700] = 'b';
+    CHECK(&kernels() == &kernel_table(detect_isa_level()));
+
+    const KernelTable& scalar = kernel_table(ISA_SCALAR);
+    for (int level = ISA_SSE42; level <= detect_isa_level(); level++) {
+        const KernelTable& forced = kernel_table((IsaLevel)level);
+        for (size_t n : {0, 1, 7, 15, 31, 63, 64, 65, 1000}) {
+            MinMaxSum a = scalar.min_max_sum(ints.data(), n);
+            MinMaxSum b = forced.min_max_sum(ints.data(), n);
+            CHECK(a.min == b.min && a.max == b.max && a.sum == b.sum);
+
+            CHECK(forced.find_byte(text.data(), n, 'b') == 
+                  scalar.find_byte(text.data(), n, 'b'));
+
+            uint32_t expected_counts[256], counts[256];
+            scalar.radix_histogram(keys.data(), n, 8, expected_counts);
+            forced.radix_histogram(keys.data(), n, 8, counts);
+            CHECK(equal(counts, counts + 256, expected_counts));
+
+            scalar.hash_keys(wide.data(), n, expected_hashes.data());
+            forced.hash_keys(wide.data(), n, hashes.data());
+            CHECK(equal(hashes.begin(), hashes.begin() + n, 
+                        expected_hashes.begin()));
+        }
+    }
+
+    string hay(3 * 64 + 1, 'a');
+    for (int level = ISA_SCALAR; level <= detect_isa_level(); level++) {
+        const KernelTable& forced = kernel_table((IsaLevel)level);
+        size_t misplaced = 0;
+        for (size_t n = 0; n <= hay.size(); n++) {
+            misplaced += forced.find_byte(hay.data(), n, 'b') != nullptr;
+            for (size_t i = 0; i < n; i++) {
+                hay[i] = hay[n - 1] = 'b';  // a later match must not win
+                misplaced += forced.find_byte(hay.data(), n, 'b') != 
+                             hay.data() + i;
+                hay[i] = hay[n - 1] = 'a';
+            }
+        }
+        CHECK(misplaced == 0);
+    }
+}
+
+void kernel_dispatch_benchmark() {
+    const size_t N = 1 << 24;
+    vector<int32_t> ints(N, 1);
+    vector<uint32_t> keys(N, 7);
+    vector<uint64_t> wide(N, 3), hashes(N);
+    string text(N, 'a');
+    uint32_t counts[256];
+
+    // gigabytes of input read per second
+    auto gb_per_sec = [](size_t bytes, auto kernel) {
+        auto start = chrono::steady_clock::now();
+        kernel();
+        chrono::duration<double> t = chrono::steady_clock::now() - start;
+        return bytes / t.count() / 1e9;
+    };
+    cout << "detected: " << ISA_NAMES[detect_isa_level()] << endl;
+    for (int level = ISA_SCALAR; level <= detect_isa_level(); level++) {
+        const KernelTable& k = kernel_table((IsaLevel)level);
+        cout << ISA_NAMES[level] << ": min/max/sum " 
+             << gb_per_sec(N * 4, [&] {
+                    do_not_optimize(k.min_max_sum(ints.data(), N).sum); })
+             << " GB/s, find " 
+             << gb_per_sec(N, [&] {
+                    do_not_optimize(k.find_byte(text.data(), N, 'b')); })
+             << " GB/s, histogram " 
+             << gb_per_sec(N * 4, [&] {
+                    k.radix_histogram(keys.data(), N, 0, counts);
+                    do_not_optimize(counts[7]); })
+             << " GB/s, hash " 
+             << gb_per_sec(N * 8, [&] {
+                    k.hash_keys(wide.data(), N, hashes.data());
+                    do_not_optimize(hashes[N - 1]); })
+             << " GB/s" << endl;
+    }
+}
+
+
+/** SORTING NETWORKS AND SMALL SORTS
+
+    Quicksort and merge sort only pay off on large arrays; below a few dozen 
+    elements their bookkeeping costs more than the sorting, so real 
+    implementations stop recursing and finish each small partition with 
+    insertion sort. On random data those leaves are a large share of the 
+    total time, and insertion sort is a poor fit for a modern CPU: whether an 
+    element moves again is a coin flip, and a mispredicted branch costs 
+    around 15 cycles.
+
+    A sorting network is a fixed sequence of compare-exchange operations, 
+    each of which puts the smaller of two positions first. The sequence does 
+    not depend on the data, so it has no unpredictable branches: each 
+    compare-exchange selects the smaller and the larger value on one 
+    comparison, which compiles to conditional moves. This is worth checking 
+    with objdump -d. For network_sort_fixed<int32_t, 16>, GCC 12 at -O2 
+    emits 126 cmovs and no jumps for the 63 comparators. Written with 
+    std::min and std::max, which return references, it emitted a jump for 
+    every comparator. Floating-point keys still get jumps. 
+    Batcher's odd-even merge sort network sorts n elements with 
+    O(n log^2 n) comparators, which for n <= 32 is close to the best known. 
+    Its comparators are generated at compile time below, for every n.
+
+    The same idea vectorises. A bitonic network (also Batcher's) compares 
+    position i with position i ^ j at every step, so a vector register of L 
+    lanes can do L compare-exchanges at once: shuffle the register so each 
+    lane faces its partner, take the min and max of the two registers, and 
+    blend, keeping the min in the lanes that should be smaller. Between 
+    registers, no shuffle is needed at all. GCC's vector extensions express 
+    this once for any lane width, and compiling it for the AVX2 and AVX-512 
+    targets (see RUNTIME CPU DISPATCH) gives 8 and 16 lane versions for 
+    32-bit keys, and 4 and 8 lane versions for 64-bit keys. The last stage 
+    of a bitonic sort merges two sorted registers, which also gives a 
+    vectorised merge of two sorted arrays, L elements at a time.
+
+    Key-value pairs with 32-bit keys and values are sorted as one 64-bit key 
+    each, with the key in the high half. Both sorts and merges plug into the 
+    quicksort and merge sort below as their base case.
+*/
+
+#include <array>
+#include <utility>
+#include <cstring>
+
+template <class T>
+void insertion_sort(T* a, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        T x = a[i];
+        size_t j = i;
+        for (; j > 0 && x < a[j - 1]; j--)
+            a[j] = a[j - 1];
+        a[j] = x;
+    }
+}
+
+struct Comparator {
+    uint8_t lo;
+    uint8_t hi;
+};
+
+struct Network {
+    Comparator comparators[256];
+    size_t size;
+};
+
+// Batcher's odd-even merge sort for any n, dropping comparators beyond n
+constexpr Network batcher_network(size_t n) {
+    Network network = {};
+    for (size_t p = 1; p < n; p *= 2)
+        for (size_t k = p; k >= 1; k /= 2)
+            for (size_t j = k % p; j + k < n; j += 2 * k)
+                for (size_t i = 0; i < k && i + j + k < n; i++)
+                    if ((i + j) / (2 * p) == (i + j + k) / (2 * p))
+                        network.comparators[network.size++] = 
+                            {(uint8_t)(i + j), (uint8_t)(i + j + k)};
+    return network;
+}
+
+template <size_t N>
+constexpr Network NETWORK = batcher_network(N);
+
+template <class T>
+inline void compare_exchange(T& x, T& y) {
+    T lo = y < x ? y : x, hi = y < x ? x : y;
+    x = lo;
+    y = hi;
+}
+
+/**
+    The comparators are expanded into straight-line code by a fold over their 
+    indices, and the values are copied into a local array, so that the 
+    compiler can keep them all in registers.
+*/
+template <class T, size_t N, size_t... Cs>
+void network_sort_fixed(T* a, index_sequence<Cs...>) {
+    T v[N + 1];
+    copy(a, a + N, v);
+    (compare_exchange(v[NETWORK<N>.comparators[Cs].lo], 
+                      v[NETWORK<N>.comparators[Cs].hi]), ...);
+    copy(v, v + N, a);
+}
+
+template <class T, size_t N>
+void network_sort_fixed(T* a) {
+    network_sort_fixed<T, N>(a, make_index_sequence<NETWORK<N>.size>());
+}
+
+template <class T, size_t... Ns>
+constexpr array<void (*)(T*), sizeof...(Ns)> network_table(
+        index_sequence<Ns...>) {
+    return {{network_sort_fixed<T, Ns>...}};
+}
+
+// Falls back to insertion sort above 32 elements
+template <class T>
+void network_sort(T* a, size_t n) {
+    static constexpr auto TABLE = network_table<T>(make_index_sequence<33>());
+    if (n > 32)
+        insertion_sort(a, n);
+    else
+        TABLE[n](a);
+}
+
+/**
+    The generic kernels are always inlined, so that they are compiled with 
+    the target of the function that calls them.
+*/
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// Bitonic sort of the R * L values in R registers of L lanes
+template <class V, int R>
+ALWAYS_INLINE void bitonic_sort_regs(V (&regs)[R]) {
+    const int L = sizeof(V) / sizeof(regs[0][0]);
+    V lane;
+    for (int i = 0; i < L; i++)
+        lane[i] = i;
+    for (int k = 2; k <= R * L; k *= 2) {
+        for (int j = k / 2; j > 0; j /= 2) {
+            if (R > 1 && j >= L) {
+                // partners are whole registers apart
+                for (int r = 0; r < R; r++) {
+                    int p = r ^ (j / L);
+                    if (p < r)
+                        continue;
+                    V lo = regs[r] < regs[p] ? regs[r] : regs[p];
+                    V hi = regs[r] < regs[p] ? regs[p] : regs[r];
+                    bool ascending = (r * L & k) == 0;
+                    regs[r] = ascending ? lo : hi;
+                    regs[p] = ascending ? hi : lo;
+                }
+            } else {
+                V partner = lane ^ j;
+                V lower = (lane & j) == 0;
+                for (int r = 0; r < R; r++) {
+                    V other = __builtin_shuffle(regs[r], partner);
+                    V take_min = (((lane + r * L) & k) == 0) == lower;
+                    V lo = regs[r] < other ? regs[r] : other;
+                    V hi = regs[r] < other ? other : regs[r];
+                    regs[r] = take_min ? lo : hi;
+                }
+            }
+        }
+    }
+}
+
+// Sorts n <= R * L values, padding the registers with the largest value
+template <class V, class T, int R>
+ALWAYS_INLINE void bitonic_sort_fixed(T* a, size_t n) {
+    const size_t L = sizeof(V) / sizeof(T);
+    alignas(64) T buffer[R * L];
+    copy(a, a + n, buffer);
+    fill(buffer + n, buffer + R * L, numeric_limits<T>::max());
+    V regs[R];
+    memcpy(regs, buffer, sizeof(regs));
+    bitonic_sort_regs<V, R>(regs);
+    memcpy(buffer, regs, sizeof(regs));
+    copy(buffer, buffer + n, a);
+}
+
+// Picks the fewest registers that hold n, up to 16
+template <class V, class T, int R = 1>
+ALWAYS_INLINE void bitonic_sort_body(T* a, size_t n) {
+    if constexpr (R < 16) {
+        if (n > R * sizeof(V) / sizeof(T)) {
+            bitonic_sort_body<V, T, 2 * R>(a, n);
+            return;
+        }
+    }
+    bitonic_sort_fixed<V, T, R>(a, n);
+}
+
+/**
+    Merges two sorted registers: lo ends up with the smallest L values and hi 
+    with the largest, both sorted. Reversing hi makes the pair one bitonic 
+    sequence, so only the final merge stage of the network is needed.
+*/
+template <class V>
+ALWAYS_INLINE void bitonic_merge_regs(V& lo, V& hi) {
+    const int L = sizeof(V) / sizeof(lo[0]);
+    V lane;
+    for (int i = 0; i < L; i++)
+        lane[i] = i;
+    V reversed = __builtin_shuffle(hi, (L - 1) - lane);
+    V a = lo < reversed ? lo : reversed;
+    V b = lo < reversed ? reversed : lo;
+    for (int j = L / 2; j > 0; j /= 2) {
+        V partner = lane ^ j;
+        V lower = (lane & j) == 0;
+        V other_a = __builtin_shuffle(a, partner);
+        V other_b = __builtin_shuffle(b, partner);
+        V min_a = a < other_a ? a : other_a, max_a = a < other_a ? other_a : a;
+        V min_b = b < other_b ? b : other_b, max_b = b < other_b ? other_b : b;
+        a = lower ? min_a : max_a;
+        b = lower ? min_b : max_b;
+    }
+    lo = a;
+    hi = b;
+}
+
+/**
+    Merges two sorted arrays L elements at a time: merge two registers, emit 
+    the lower one, and refill it from the input whose next element is 
+    smaller. That rule is only safe while both inputs have a full register 
+    left, so the last few elements are merged by std::merge.
+*/
+template <class V, class T>
+ALWAYS_INLINE void simd_merge_body(const T* a, size_t na, const T* b, 
+                                   size_t nb, T* out) {
+    const size_t L = sizeof(V) / sizeof(T);
+    if (na < L || nb < L) {
+        merge(a, a + na, b, b + nb, out);
+        return;
+    }
+    V lo, hi;
+    memcpy(&lo, a, sizeof(V));
+    memcpy(&hi, b, sizeof(V));
+    size_t i = L, j = L;
+    for (;;) {
+        bitonic_merge_regs(lo, hi);
+        memcpy(out, &lo, sizeof(V));
+        out += L;
+        bool a_full = i + L <= na, b_full = j + L <= nb;
+        if (a_full && (b_full ? a[i] <= b[j] : j == nb)) {
+            memcpy(&lo, a + i, sizeof(V));
+            i += L;
+        } else if (b_full && (a_full || i == na)) {
+            memcpy(&lo, b + j, sizeof(V));
+            j += L;
+        } else {
+            break;
+        }
+    }
+    // three sorted runs remain: the register and the tails of a and b
+    T last[L];
+    memcpy(last, &hi, sizeof(V));
+    vector<T> rest(L + na - i);
+    merge(last, last + L, a + i, a + na, rest.begin());
+    merge(rest.begin(), rest.end(), b + j, b + nb, out);
+}
+
+/**
+    Above 16 registers, sorts each half and merges them, so the sort takes 
+    any n, but it is meant for leaves of up to a few hundred elements.
+*/
+template <class V, class T>
+ALWAYS_INLINE void simd_sort_body(T* a, size_t n, void (*self)(T*, size_t)) {
+    if (n <= 16 * sizeof(V) / sizeof(T)) {
+        bitonic_sort_body<V, T>(a, n);
+        return;
+    }
+    self(a, n / 2);
+    self(a + n / 2, n - n / 2);
+    vector<T> merged(n);
+    simd_merge_body<V, T>(a, n / 2, a + n / 2, n - n / 2, merged.data());
+    copy(merged.begin(), merged.end(), a);
+}
+
+TARGET_AVX2 void simd_sort_avx2(int32_t* a, size_t n) {
+    simd_sort_body<Int32x8>(a, n, simd_sort_avx2);
+}
+
+TARGET_AVX2 void simd_sort_avx2(int64_t* a, size_t n) {
+    simd_sort_body<Int64x4>(a, n, simd_sort_avx2);
+}
+
+TARGET_AVX512 void simd_sort_avx512(int32_t* a, size_t n) {
+    simd_sort_body<Int32x16>(a, n, simd_sort_avx512);
+}
+
+TARGET_AVX512 void simd_sort_avx512(int64_t* a, size_t n) {
+    simd_sort_body<Int64x8>(a, n, simd_sort_avx512);
+}
+
+TARGET_AVX2 void simd_merge_avx2(const int32_t* a, size_t na, 
+                                 const int32_t* b, size_t nb, int32_t* out) {
+    simd_merge_body<Int32x8>(a, na, b, nb, out);
+}
+
+TARGET_AVX2 void simd_merge_avx2(const int64_t* a, size_t na, 
+                                 const int64_t* b, size_t nb, int64_t* out) {
+    simd_merge_body<Int64x4>(a, na, b, nb, out);
+}
+
+TARGET_AVX512 void simd_merge_avx512(const int32_t* a, size_t na, 
+                                     const int32_t* b, size_t nb, 
+                                     int32_t* out) {
+    simd_merge_body<Int32x16>(a, na, b, nb, out);
+}
+
+TARGET_AVX512 void simd_merge_avx512(const int64_t* a, size_t na, 
+                                     const int64_t* b, size_t nb, 
+                                     int64_t* out) {
+    simd_merge_body<Int64x8>(a, na, b, nb, out);
+}
+
+template <class T>
+void scalar_small_sort(T* a, size_t n) {
+    network_sort(a, n);
+}
+
+template <class T>
+void scalar_merge(const T* a, size_t na, const T* b, size_t nb, T* out) {
+    merge(a, a + na, b, b + nb, out);
+}
+
+// Base cases for int32_t and int64_t keys, by instruction set
+template <class T>
+struct SortKernels {
+    void (*sort)(T* a, size_t n);
+    void (*merge)(const T* a, size_t na, const T* b, size_t nb, T* out);
+};
+
+template <class T>
+SortKernels<T> sort_kernels(IsaLevel level) {
+    if (level >= ISA_AVX512)
+        return {simd_sort_avx512, simd_merge_avx512};
+    if (level >= ISA_AVX2)
+        return {simd_sort_avx2, simd_merge_avx2};
+    return {scalar_small_sort<T>, scalar_merge<T>};
+}
+
+template <class T>
+const SortKernels<T>& sort_kernels() {
+    static const SortKernels<T> kernels = sort_kernels<T>(detect_isa_level());
+    return kernels;
+}
+
+// Sorts pairs by key, then value, as 64-bit keys with the key in the top half
+void sort_pairs(int32_t* keys, uint32_t* values, size_t n) {
+    vector<int64_t> packed(n);
+    for (size_t i = 0; i < n; i++)
+        packed[i] = (int64_t)((uint64_t)(int64_t)keys[i] << 32 | values[i]);
+    sort_kernels<int64_t>().sort(packed.data(), n);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = (int32_t)(packed[i] >> 32);
+        values[i] = (uint32_t)packed[i];
+    }
+}
+
+/**
+    Quicksort as described in the sorting notes, taking the median of the 
+    first, middle and last elements as the pivot so that sorted input is not 
+    the worst case. The partition is Hoare's: one index scans up for a key 
+    not less than the pivot, another scans down for a key not greater, and 
+    the two are swapped. Both scans stop at keys equal to the pivot, which 
+    looks wasteful but splits a run of equal keys evenly between the sides. 
+    Lomuto's partition, which only moves keys less than the pivot, puts such 
+    a run all on one side, so an array of few distinct keys takes quadratic 
+    time. Partitions of at most leaf_size elements go to leaf_sort.
+*/
+template <class T, class LeafSort>
+void quicksort(T* a, size_t n, LeafSort leaf_sort, size_t leaf_size = 32) {
+    while (n > leaf_size && n > 1) {
+        size_t mid = (n - 1) / 2;
+        if (a[mid] < a[0])
+            swap(a[mid], a[0]);
+        if (a[n - 1] < a[0])
+            swap(a[n - 1], a[0]);
+        if (a[n - 1] < a[mid])
+            swap(a[n - 1], a[mid]);
+        T pivot = a[mid];
+        // a[0] and a[n - 1] stop the scans, so neither checks its bound
+        ptrdiff_t i = -1, j = n;
+        for (;;) {
+            do
+                i++;
+            while (a[i] < pivot);
+            do
+                j--;
+            while (pivot < a[j]);
+            if (i >= j)
+                break;
+            swap(a[i], a[j]);
+        }
+        // [0, j] <= pivot <= [j + 1, n), and neither side is empty
+        size_t left = j + 1;
+        // recurse into the smaller side, so the stack stays O(log N)
+        if (left < n - left) {
+            quicksort(a, left, leaf_sort, leaf_size);
+            a += left;
+            n -= left;
+        } else {
+            quicksort(a + left, n - left, leaf_sort, leaf_size);
+            n = left;
+        }
+    }
+    leaf_sort(a, n);
+}
+
+// Bottom-up merge sort: sort the leaves, then merge runs of doubling width
+template <class T, class LeafSort, class Merge>
+void merge_sort(T* a, size_t n, LeafSort leaf_sort, Merge merge_runs, 
+                size_t leaf_size = 32) {
+    for (size_t lo = 0; lo < n; lo += leaf_size)
+        leaf_sort(a + lo, min(leaf_size, n - lo));
+    vector<T> buffer(n);
+    T* from = a;
+    T* to = buffer.data();
+    for (size_t width = leaf_size; width < n; width *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * width) {
+            size_t mid = min(lo + width, n), hi = min(lo + 2 * width, n);
+            merge_runs(from + lo, mid - lo, from + mid, hi - mid, to + lo);
+        }
+        swap(from, to);
+    }
+    if (from != a)
+        copy(from, from + n, a);
+}
+
+/**
+    By the 0-1 principle, a comparator network sorts every input if it sorts 
+    every input of 0s and 1s, so the networks are checked on all 2^n such 
+    inputs up to n = 16 and on a sample above. The kernels of each level this 
+    machine supports must also agree with std::sort and std::merge, on 
+    lengths that are not a multiple of the register width.
+*/
+template <class T>
+void test_sort_kernels(const SortKernels<T>& kernels, mt19937& rng) {
+    for (size_t n = 0; n <= 32; n++) {
+        size_t inputs = n <= 16 ? (size_t)1 << n : 1 << 14;
+        size_t network_failures = 0, kernel_failures = 0;
+        T a[32], b[32];
+        for (size_t input = 0; input < inputs; input++) {
+            uint32_t bits = n <= 16 ? input : rng();
+            for (size_t i = 0; i < n; i++)
+                a[i] = b[i] = bits >> i & 1;
+            network_sort(a, n);
+            kernels.sort(b, n);
+            // sorted, and still holding the same number of 1s
+            size_t ones = __builtin_popcount(n < 32 ? bits & ((1u << n) - 1) 
+                                                    : bits);
+            network_failures += !is_sorted(a, a + n) || 
+                                count(a, a + n, 1) != (long)ones;
+            kernel_failures += !is_sorted(b, b + n) || 
+                               count(b, b + n, 1) != (long)ones;
+        }
+        CHECK(network_failures == 0);
+        CHECK(kernel_failures == 0);
+    }
+
+    for (int trial = 0; trial < 1000; trial++) {
+        vector<T> a(rng() % 400), expected;
+        for (T& x : a)
+            x = (T)(rng() % 64 - 32);  // small range, for duplicates
+        expected = a;
+        sort(expected.begin(), expected.end());
+        kernels.sort(a.data(), a.size());
+        CHECK(a == expected);
+    }
+
+    const size_t LENGTHS[] = {0, 1, 3, 4, 7, 8, 15, 16, 17, 33, 100, 257};
+    for (size_t na : LENGTHS) {
+        for (size_t nb : LENGTHS) {
+            vector<T> a(na), b(nb), out(na + nb), expected(na + nb);
+            for (T& x : a)
+                x = (T)(rng() % 100);
+            for (T& x : b)
+                x = (T)(rng() % 100);
+            sort(a.begin(), a.end());
+            sort(b.begin(), b.end());
+            merge(a.begin(), a.end(), b.begin(), b.end(), expected.begin());
+            kernels.merge(a.data(), na, b.data(), nb, out.data());
+            CHECK(out == expected);
+        }
+    }
+}
+
+void test_small_sorts() {
+    mt19937 rng(3);
+    for (int level = ISA_SCALAR; level <= detect_isa_level(); level++) {
+        test_sort_kernels(sort_kernels<int32_t>((IsaLevel)level), rng);
+        test_sort_kernels(sort_kernels<int64_t>((IsaLevel)level), rng);
+    }
+
+    // negative keys sort first, and equal keys by value
+    const size_t N = 1000;
+    vector<int32_t> keys(N);
+    vector<uint32_t> values(N);
+    vector<pair<int32_t, uint32_t> > expected(N);
+    for (size_t i = 0; i < N; i++) {
+        keys[i] = (int32_t)(rng() % 20) - 10;
+        values[i] = rng();
+        expected[i] = {keys[i], values[i]};
+    }
+    sort(expected.begin(), expected.end());
+    sort_pairs(keys.data(), values.data(), N);
+    bool pairs_sorted = true;
+    for (size_t i = 0; i < N; i++)
+        pairs_sorted &= keys[i] == expected[i].first && 
+                        values[i] == expected[i].second;
+    CHECK(pairs_sorted);
+
+    // few distinct keys, which Lomuto's partition makes quadratic
+    vector<int32_t> few(1 << 20);
+    for (int32_t& x : few)
+        x = rng() % 3;
+    quicksort(few.data(), few.size(), insertion_sort<int32_t>, 16);
+    CHECK(is_sorted(few.begin(), few.end()));
+}
+
+/**
+    The benchmark times leaf sorts of 8 to 256 random 32-bit keys per call, 
+    then full sorts of 2^24 keys with insertion sort and with the vectorised 
+    kernels as the base case.
+*/
+void small_sort_benchmark() {
+    mt19937 rng(7);
+    const SortKernels<int32_t>& simd = sort_kernels<int32_t>();
+    cout << "kernels: " << ISA_NAMES[detect_isa_level()] << endl;
+
+    for (size_t n = 8; n <= 256; n *= 2) {
+        const size_t CALLS = (1 << 22) / n;
+        vector<int32_t> input(n * CALLS), data;
+        for (int32_t& x : input)
+            x = rng();
+        auto ns_per_call = [&](auto leaf_sort) {
+            data = input;
+            auto start = chrono::steady_clock::now();
+            for (size_t c = 0; c < CALLS; c++)
+                leaf_sort(data.data() + c * n, n);
+            chrono::duration<double, nano> t = 
+                chrono::steady_clock::now() - start;
+            return t.count() / CALLS;
+        };
+        cout << n << " elements: insertion " 
+             << ns_per_call(insertion_sort<int32_t>) << " ns, network " 
+             << ns_per_call(network_sort<int32_t>) << " ns, vectorised " 
+             << ns_per_call(simd.sort) << " ns, std::sort " 
+             << ns_per_call([](int32_t* a, size_t m) { sort(a, a + m); }) 
+             << " ns" << endl;
+    }
+
+    vector<int32_t> input(1 << 24), data;
+    for (int32_t& x : input)
+        x = rng();
+    auto sort_seconds = [&](auto full_sort) {
+        data = input;
+        double t = seconds([&] { full_sort(data.data(), data.size()); });
+        CHECK(is_sorted(data.begin(), data.end()));
+        return t;
+    };
+    cout << "quicksort: insertion leaves " 
+         << sort_seconds([](int32_t* a, size_t n) {
+                quicksort(a, n, insertion_sort<int32_t>, 16); })
+         << " s, vectorised leaves " << sort_seconds([&](int32_t* a, size_t n) {
+                quicksort(a, n, simd.sort, 64); })
+         << " s" << endl;
+    cout << "merge sort: insertion leaves " 
+         << sort_seconds([](int32_t* a, size_t n) {
+                merge_sort(a, n, insertion_sort<int32_t>, 
+                           scalar_merge<int32_t>, 16); })
+         << " s, vectorised leaves and merges " 
+         << sort_seconds([&](int32_t* a, size_t n) {
+                merge_sort(a, n, simd.sort, simd.merge, 64); })
+         << " s, std::sort " << sort_seconds([](int32_t* a, size_t n) {
+                sort(a, a + n); })
+         << " s" << endl;
+}
+
+
+/** WHAT IS A BOOTSTRAP?
+
+    This describes the self-sustaining process of booting a computer from 
+    simple to complex. It also refers to an early piece of fundamental software 
+    hand-written directly to machine code to allow other software compilers to 
+    be written, to allow other software to be written, in which, paradoxically, 
+    better compilers and bootstraps could be written.
+*/
+
+
+/** BOOTING
+
+    Booting is essentially putting the computer into a state where it is 
+    interactive to humans, by climbing layers of abstraction.
+
+    The basic input output system (BIOS) is firmware for a particular 
+    motherboard model that initialises i/o hardware at boot time. It is the 
+    first event during booting. It loads a boot loader.
+
+    A boot loader is a small piece of software that puts an OS into memory.
+
+    An operating system is system software that manages computer hardware and 
+    software resources and provides common services for computer programs.
+*/
 
 
 /** WHAT IS A KERNEL, A SHELL, POSIX?
@@ -835,6 +4620,729 @@ void thread_example() {
 */
 
 
+/** MEMORY-MAPPED INDEX FILES
+
+    Persisting a data structure usually means serialising it, e.g. to text, 
+    and rebuilding it on load: parse every record, allocate every node, 
+    rehash every key. For a large index that is minutes of startup. The 
+    alternative is to store the structure exactly as it is laid out in 
+    memory, and mmap the file read-only. Loading is then constant time: the 
+    OS maps the file into the address space and reads each page from disk the 
+    first time it is touched (a page fault), or not at all if it is already in 
+    the page cache from a previous run.
+
+    This only works for flat structures with no raw pointers, since the 
+    mapping lands at a different address every time. Every reference is 
+    stored as an offset from the start of its section instead, so the file is 
+    position independent. Arrays start on a 64-byte boundary and sections on 
+    a page boundary, and mmap returns page-aligned memory, so every array is 
+    cache-line aligned when mapped. The file starts with a magic number, a 
+    format version and a byte-order mark, then a table of sections with a 
+    checksum for each. Verifying a checksum reads the whole section, which 
+    would defeat the point at startup, so it is done on request.
+
+    madvise() tells the kernel how the mapping will be used: MADV_WILLNEED 
+    starts reading the whole file in the background (prefetching), and 
+    MADV_RANDOM turns off read-ahead for the hash table, whose probes land on 
+    random pages. The containers are a sorted array, an open-addressing hash 
+    table, a static B+-tree and a CSR graph, each with a view class that 
+    queries the mapped bytes directly.
+*/
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+const uint32_t INDEX_VERSION = 1;
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+enum SectionKind : uint32_t {
+    SECTION_SORTED_ARRAY = 1,
+    SECTION_HASH_TABLE,
+    SECTION_BTREE,
+    SECTION_CSR_GRAPH
+};
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t n_sections;
+    // followed by n_sections SectionEntry
+};
+
+struct SectionEntry {
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t checksum;
+};
+
+// A pointer stored as an offset from the start of its section
+template <class T>
+struct SectionPtr {
+    uint64_t offset;
+
+    const T* get(const char* section) const {
+        return (const T*)(section + offset);
+    }
+};
+
+// Four interleaved hash64 chains, so the multiplies overlap
+uint64_t checksum(const char* data, size_t n) {
+    uint64_t lanes[4] = {1, 2, 3, 4};
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        for (int l = 0; l < 4; l++) {
+            uint64_t word;
+            memcpy(&word, data + i + 8 * l, 8);
+            lanes[l] = hash64(lanes[l] ^ word);
+        }
+    }
+    uint64_t sum = n;
+    for (; i < n; i++)
+        sum = hash64(sum ^ (uint8_t)data[i]);
+    for (int l = 0; l < 4; l++)
+        sum = hash64(sum ^ lanes[l]);
+    return sum;
+}
+
+uint64_t page_align(uint64_t offset) {
+    return (offset + 4095) / 4096 * 4096;
+}
+
+/**
+    Writes an index file one section at a time, straight from the data each 
+    section is built from, so no section is copied or held until the end. 
+    The table of sections comes first in the file but is only complete at 
+    the end, so room for max_sections entries is left there, and finish() 
+    fills it in with the file header. Until then the magic number is zeros, 
+    so a file whose writer failed part way never opens as an index.
+*/
+class IndexWriter {
+public:
+    explicit IndexWriter(const string& path, size_t max_sections = 16)
+        : _path(path), _max_sections(max_sections) {
+        _fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (_fd < 0)
+            throw runtime_error("cannot create " + path);
+        _end = page_align(sizeof(FileHeader) + 
+                          max_sections * sizeof(SectionEntry));
+    }
+
+    ~IndexWriter() {
+        if (_fd >= 0)
+            close(_fd);
+    }
+
+    IndexWriter(const IndexWriter&) = delete;
+    IndexWriter& operator=(const IndexWriter&) = delete;
+
+    void write_at(uint64_t offset, const void* data, size_t n) {
+        const char* bytes = (const char*)data;
+        while (n > 0) {
+            ssize_t written = pwrite(_fd, bytes, n, offset);
+            if (written <= 0)
+                throw runtime_error("cannot write " + _path);
+            bytes += written;
+            offset += written;
+            n -= written;
+        }
+    }
+
+    // where the next section starts; sections are written one at a time
+    uint64_t begin_section() const {
+        if (_table.size() == _max_sections)
+            throw invalid_argument("too many sections for " + _path);
+        return _end;
+    }
+
+    /**
+        The section was written in pieces and its header last, so it is 
+        checksummed by mapping it back, from the page cache, once complete.
+    */
+    void end_section(SectionKind kind, uint64_t offset, uint64_t size) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, _fd, offset);
+        if (mapped == MAP_FAILED)
+            throw runtime_error("cannot map " + _path);
+        _table.push_back({kind, 0, offset, size, 
+                          checksum((const char*)mapped, size)});
+        munmap(mapped, size);
+        _end = page_align(offset + size);
+    }
+
+    void finish() {
+        FileHeader header = {{'N', 'O', 'T', 'E', 'S', 'I', 'D', 'X'}, 
+                             INDEX_VERSION, BYTE_ORDER_MARK, _table.size()};
+        write_at(sizeof(header), _table.data(), 
+                 _table.size() * sizeof(SectionEntry));
+        write_at(0, &header, sizeof(header));
+        // on disk before the index is used, and clean in the page cache
+        bool synced = fdatasync(_fd) == 0;
+        close(_fd);
+        _fd = -1;
+        if (!synced)
+            throw runtime_error("cannot sync " + _path);
+    }
+
+private:
+    string _path;
+    size_t _max_sections;
+    int _fd;
+    uint64_t _end;
+    vector<SectionEntry> _table;
+};
+
+/**
+    Writes one section: a header struct at offset 0, then each array on a 
+    cache line boundary, written to the file as it is appended. The header is 
+    written last, once the offsets of the arrays are known.
+*/
+class SectionBuilder {
+public:
+    SectionBuilder(IndexWriter& writer, SectionKind kind, size_t header_size)
+        : _writer(writer), _kind(kind), _start(writer.begin_section()), 
+          _size(header_size) {}
+
+    template <class T>
+    SectionPtr<T> append(const T* data, size_t n) {
+        _size = (_size + 63) / 64 * 64;
+        SectionPtr<T> ptr = {_size};
+        _writer.write_at(_start + _size, data, n * sizeof(T));
+        _size += n * sizeof(T);
+        return ptr;
+    }
+
+    template <class Header>
+    void finish(const Header& header) {
+        _writer.write_at(_start, &header, sizeof(Header));
+        _writer.end_section(_kind, _start, _size);
+    }
+
+private:
+    IndexWriter& _writer;
+    SectionKind _kind;
+    uint64_t _start;
+    uint64_t _size;
+};
+
+/**
+    A view takes the result of MappedIndex::section(), which is null if the 
+    file has no section of that kind.
+*/
+template <class Header>
+const Header* section_header(const char* section) {
+    if (!section)
+        throw runtime_error("the index has no section for this view");
+    return (const Header*)section;
+}
+
+struct SortedArrayHeader {
+    uint64_t n;
+    SectionPtr<uint64_t> keys;
+};
+
+void sorted_array_section(IndexWriter& writer, 
+                          const vector<uint64_t>& sorted_keys) {
+    SectionBuilder builder(writer, SECTION_SORTED_ARRAY, 
+                           sizeof(SortedArrayHeader));
+    SortedArrayHeader header = {sorted_keys.size(), 
+        builder.append(sorted_keys.data(), sorted_keys.size())};
+    builder.finish(header);
+}
+
+class SortedArrayView {
+public:
+    explicit SortedArrayView(const char* section)
+        : _n(section_header<SortedArrayHeader>(section)->n), 
+          _keys(section_header<SortedArrayHeader>(section)->keys.get(
+              section)) {}
+
+    size_t size() const { return _n; }
+    uint64_t operator[](size_t i) const { return _keys[i]; }
+    bool contains(uint64_t key) const {
+        return binary_search(_keys, _keys + _n, key);
+    }
+
+private:
+    uint64_t _n;
+    const uint64_t* _keys;
+};
+
+/**
+    The hash table uses open addressing with linear probing: a key goes in 
+    the slot its hash selects, or the next free one after it. Keys and values 
+    are interleaved so a probe costs one cache miss. The load is at most 1/2 
+    and EMPTY_KEY marks a free slot, so it cannot be stored.
+*/
+const uint64_t EMPTY_KEY = numeric_limits<uint64_t>::max();
+
+struct HashSlot {
+    uint64_t key;
+    uint64_t value;
+};
+
+struct HashTableHeader {
+    uint64_t capacity;
+    SectionPtr<HashSlot> slots;
+};
+
+void hash_table_section(IndexWriter& writer, 
+                        const vector<pair<uint64_t, uint64_t> >& entries) {
+    for (const auto& entry : entries)
+        if (entry.first == EMPTY_KEY)
+            throw invalid_argument("EMPTY_KEY cannot be stored");
+    uint64_t capacity = 2;
+    while (capacity < 2 * entries.size())
+        capacity *= 2;
+    vector<HashSlot> slots(capacity, HashSlot{EMPTY_KEY, 0});
+    for (const auto& entry : entries) {
+        uint64_t s = hash64(entry.first) & (capacity - 1);
+        while (slots[s].key != EMPTY_KEY && slots[s].key != entry.first)
+            s = (s + 1) & (capacity - 1);
+        slots[s] = {entry.first, entry.second};
+    }
+    SectionBuilder builder(writer, SECTION_HASH_TABLE, 
+                           sizeof(HashTableHeader));
+    HashTableHeader header = {capacity, 
+                              builder.append(slots.data(), capacity)};
+    builder.finish(header);
+}
+
+class HashTableView {
+public:
+    explicit HashTableView(const char* section)
+        : _capacity(section_header<HashTableHeader>(section)->capacity), 
+          _slots(section_header<HashTableHeader>(section)->slots.get(
+              section)) {}
+
+    Expected<uint64_t, LookupError> find(uint64_t key) const {
+        for (uint64_t s = hash64(key) & (_capacity - 1); 
+             _slots[s].key != EMPTY_KEY; s = (s + 1) & (_capacity - 1))
+            if (_slots[s].key == key)
+                return _slots[s].value;
+        return make_unexpected(LookupError::NOT_FOUND);
+    }
+
+private:
+    uint64_t _capacity;
+    const HashSlot* _slots;
+};
+
+/**
+    A static B+-tree over unique sorted keys. Level 0 holds every key in 
+    nodes of 8 (one cache line), and each level above holds the first key of 
+    every node below, until one node remains. A search counts, branch-free, 
+    how many keys of a node are <= the key, and descends into that child. 
+    Nodes are padded with EMPTY_KEY, which again cannot be stored, and which 
+    the count skips: a search for EMPTY_KEY itself would otherwise count the 
+    padding and descend into a child that does not exist.
+*/
+const int BTREE_FANOUT = 8;
+const int BTREE_MAX_LEVELS = 24;
+
+struct BTreeHeader {
+    uint64_t n;
+    uint64_t n_levels;
+    SectionPtr<uint64_t> levels[BTREE_MAX_LEVELS];
+    SectionPtr<uint64_t> values;
+};
+
+void btree_section(IndexWriter& writer, const vector<uint64_t>& sorted_keys, 
+                   const vector<uint64_t>& values) {
+    if (values.size() != sorted_keys.size())
+        throw invalid_argument("a B+-tree needs one value per key");
+    for (size_t i = 1; i < sorted_keys.size(); i++)
+        if (sorted_keys[i - 1] >= sorted_keys[i])
+            throw invalid_argument("B+-tree keys must be sorted and unique");
+    if (!sorted_keys.empty() && sorted_keys.back() == EMPTY_KEY)
+        throw invalid_argument("EMPTY_KEY cannot be stored");
+    auto pad = [](vector<uint64_t>& level) {
+        level.resize(max<size_t>(BTREE_FANOUT, 
+            (level.size() + BTREE_FANOUT - 1) / BTREE_FANOUT * BTREE_FANOUT), 
+            EMPTY_KEY);
+    };
+    vector<vector<uint64_t> > levels(1, sorted_keys);
+    pad(levels[0]);
+    while (levels.back().size() > BTREE_FANOUT) {
+        vector<uint64_t> up;
+        for (size_t i = 0; i < levels.back().size(); i += BTREE_FANOUT)
+            up.push_back(levels.back()[i]);
+        pad(up);
+        levels.push_back(move(up));
+    }
+    if (levels.size() > BTREE_MAX_LEVELS)
+        throw invalid_argument("too many keys for a B+-tree section");
+
+    SectionBuilder builder(writer, SECTION_BTREE, sizeof(BTreeHeader));
+    BTreeHeader header = {};
+    header.n = sorted_keys.size();
+    header.n_levels = levels.size();
+    for (size_t l = 0; l < levels.size(); l++)
+        header.levels[l] = builder.append(levels[l].data(), levels[l].size());
+    header.values = builder.append(values.data(), values.size());
+    builder.finish(header);
+}
+
+class BTreeView {
+public:
+    explicit BTreeView(const char* section)
+        : _section(section), 
+          _header(section_header<BTreeHeader>(section)) {}
+
+    Expected<uint64_t, LookupError> find(uint64_t key) const {
+        size_t node = 0;
+        for (size_t l = _header->n_levels - 1; l > 0; l--) {
+            const uint64_t* keys = level(l) + node * BTREE_FANOUT;
+            int count = 0;
+            for (int i = 0; i < BTREE_FANOUT; i++)
+                count += (keys[i] <= key) & (keys[i] != EMPTY_KEY);
+            node = node * BTREE_FANOUT + max(count - 1, 0);
+        }
+        const uint64_t* keys = level(0) + node * BTREE_FANOUT;
+        size_t index = node * BTREE_FANOUT;
+        for (int i = 0; i < BTREE_FANOUT; i++)
+            index += keys[i] < key;
+        if (index >= _header->n || level(0)[index] != key)
+            return make_unexpected(LookupError::NOT_FOUND);
+        return _header->values.get(_section)[index];
+    }
+
+private:
+    const uint64_t* level(size_t l) const {
+        return _header->levels[l].get(_section);
+    }
+
+    const char* _section;
+    const BTreeHeader* _header;
+};
+
+struct CsrGraphHeader {
+    uint64_t n_vertices;
+    uint64_t n_edges;
+    SectionPtr<uint64_t> offsets;
+    SectionPtr<uint32_t> targets;
+    SectionPtr<float> weights;
+};
+
+void csr_graph_section(IndexWriter& writer, const CsrGraph& g) {
+    vector<uint64_t> offsets(g.num_vertices() + 1);
+    vector<uint32_t> targets(g.num_edges());
+    vector<float> weights(g.num_edges());
+    for (uint32_t v = 0; v < g.num_vertices(); v++)
+        offsets[v + 1] = g.last_edge(v);
+    for (uint64_t e = 0; e < g.num_edges(); e++) {
+        targets[e] = g.target(e);
+        weights[e] = g.weight(e);
+    }
+    SectionBuilder builder(writer, SECTION_CSR_GRAPH, sizeof(CsrGraphHeader));
+    CsrGraphHeader header = {g.num_vertices(), g.num_edges(), 
+        builder.append(offsets.data(), offsets.size()), 
+        builder.append(targets.data(), targets.size()), 
+        builder.append(weights.data(), weights.size())};
+    builder.finish(header);
+}
+
+// The read-only interface of CsrGraph, over a mapped section
+class CsrGraphView {
+public:
+    explicit CsrGraphView(const char* section) {
+        const CsrGraphHeader* header = 
+            section_header<CsrGraphHeader>(section);
+        _n_vertices = header->n_vertices;
+        _n_edges = header->n_edges;
+        _offsets = header->offsets.get(section);
+        _targets = header->targets.get(section);
+        _weights = header->weights.get(section);
+    }
+
+    uint32_t num_vertices() const { return _n_vertices; }
+    uint64_t num_edges() const { return _n_edges; }
+    uint64_t first_edge(uint32_t v) const { return _offsets[v]; }
+    uint64_t last_edge(uint32_t v) const { return _offsets[v + 1]; }
+    uint64_t degree(uint32_t v) const { return _offsets[v + 1] - _offsets[v]; }
+    uint32_t target(uint64_t e) const { return _targets[e]; }
+    float weight(uint64_t e) const { return _weights[e]; }
+
+private:
+    uint64_t _n_vertices;
+    uint64_t _n_edges;
+    const uint64_t* _offsets;
+    const uint32_t* _targets;
+    const float* _weights;
+};
+
+class MappedIndex {
+public:
+    explicit MappedIndex(const string& path, bool prefetch = false) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw runtime_error("cannot open " + path);
+        struct stat st;
+        fstat(fd, &st);
+        _size = st.st_size;
+        void* base = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);  // the mapping keeps the file open
+        if (base == MAP_FAILED)
+            throw runtime_error("cannot map " + path);
+        _base = (const char*)base;
+        if (!valid()) {
+            munmap(base, _size);
+            throw runtime_error(path + " is not a version " + 
+                                to_string(INDEX_VERSION) + " index");
+        }
+        if (prefetch)
+            madvise(base, _size, MADV_WILLNEED);
+        for (const SectionEntry& entry : sections())
+            if (entry.kind == SECTION_HASH_TABLE)
+                madvise((char*)base + entry.offset, entry.size, MADV_RANDOM);
+    }
+
+    ~MappedIndex() { munmap((void*)_base, _size); }
+
+    MappedIndex(const MappedIndex&) = delete;
+    MappedIndex& operator=(const MappedIndex&) = delete;
+
+    // the first section of a kind, or nullptr
+    const char* section(SectionKind kind) const {
+        for (const SectionEntry& entry : sections())
+            if (entry.kind == kind)
+                return _base + entry.offset;
+        return nullptr;
+    }
+
+    // reads every section in full, so it is not done on open
+    bool verify() const {
+        for (const SectionEntry& entry : sections())
+            if (checksum(_base + entry.offset, entry.size) != entry.checksum)
+                return false;
+        return true;
+    }
+
+private:
+    const FileHeader* header() const { return (const FileHeader*)_base; }
+
+    vector<SectionEntry> sections() const {
+        const SectionEntry* table = (const SectionEntry*)(header() + 1);
+        return vector<SectionEntry>(table, table + header()->n_sections);
+    }
+
+    bool valid() const {
+        if (_size < sizeof(FileHeader) || 
+            memcmp(header()->magic, "NOTESIDX", 8) != 0 || 
+            header()->version != INDEX_VERSION || 
+            header()->byte_order != BYTE_ORDER_MARK || 
+            header()->n_sections > (_size - sizeof(FileHeader)) / 
+                                   sizeof(SectionEntry))
+            return false;
+        for (const SectionEntry& entry : sections())
+            if (entry.offset % 4096 != 0 || entry.offset > _size || 
+                entry.size > _size - entry.offset)
+                return false;
+        return true;
+    }
+
+    const char* _base;
+    size_t _size;
+};
+
+/**
+    Writes all four kinds of section, maps the file, and compares every view 
+    with the data it was built from. Bad input to the writer must be refused, 
+    and a view of a section the file lacks must throw rather than read from a 
+    null pointer. Then one byte of the file is flipped, which verify() must 
+    notice.
+*/
+void test_mapped_index(const string& path = "/tmp/notes_index_test.bin") {
+    mt19937_64 rng(4);
+    // the extremes of the key range, and random keys below EMPTY_KEY
+    vector<pair<uint64_t, uint64_t> > entries = {{0, 1}, {EMPTY_KEY - 1, 2}};
+    for (int i = 0; i < 100000; i++)
+        entries.push_back({rng() >> 1, rng()});
+    sort(entries.begin(), entries.end());
+    entries.erase(unique(entries.begin(), entries.end(), 
+                         [](const auto& a, const auto& b) {
+                             return a.first == b.first;
+                         }), entries.end());
+    vector<uint64_t> keys, values;
+    for (const auto& entry : entries) {
+        keys.push_back(entry.first);
+        values.push_back(entry.second);
+    }
+    CsrGraph graph(1 << 10, rmat_edges(10, 4, 5));
+
+    IndexWriter writer(path);
+    sorted_array_section(writer, keys);
+    hash_table_section(writer, entries);
+    btree_section(writer, keys, values);
+    csr_graph_section(writer, graph);
+    writer.finish();
+    {
+        MappedIndex index(path);
+        CHECK(index.verify());
+        SortedArrayView sorted(index.section(SECTION_SORTED_ARRAY));
+        HashTableView hash_table(index.section(SECTION_HASH_TABLE));
+        BTreeView btree(index.section(SECTION_BTREE));
+        CsrGraphView mapped(index.section(SECTION_CSR_GRAPH));
+
+        size_t mismatches = 0;
+        CHECK(sorted.size() == keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            Expected<uint64_t, LookupError> in_hash = hash_table.find(keys[i]);
+            Expected<uint64_t, LookupError> in_btree = btree.find(keys[i]);
+            mismatches += sorted[i] != keys[i] || !sorted.contains(keys[i]) 
+                || !in_hash || *in_hash != values[i] 
+                || !in_btree || *in_btree != values[i];
+        }
+        // random keys from the same range, skipping the few present
+        for (int i = 0; i < 1000; i++) {
+            uint64_t absent = rng() >> 1;
+            if (binary_search(keys.begin(), keys.end(), absent))
+                continue;
+            mismatches += sorted.contains(absent) || 
+                          (bool)hash_table.find(absent) || 
+                          (bool)btree.find(absent);
+        }
+        CHECK(mismatches == 0);
+        CHECK(!btree.find(EMPTY_KEY) && !hash_table.find(EMPTY_KEY));
+
+        CHECK(mapped.num_vertices() == graph.num_vertices());
+        CHECK(mapped.num_edges() == graph.num_edges());
+        bool same_graph = true;
+        for (uint32_t v = 0; v < graph.num_vertices(); v++)
+            same_graph &= mapped.first_edge(v) == graph.first_edge(v) && 
+                          mapped.degree(v) == graph.degree(v);
+        for (uint64_t e = 0; e < graph.num_edges(); e++)
+            same_graph &= mapped.target(e) == graph.target(e) && 
+                          mapped.weight(e) == graph.weight(e);
+        CHECK(same_graph);
+    }
+
+    // bad input is refused, and a view of a missing section throws
+    {
+        IndexWriter bad(path, 1);
+        auto refused = [](auto write) {
+            try {
+                write();
+            } catch (const invalid_argument&) {
+                return true;
+            }
+            return false;
+        };
+        CHECK(refused([&] { hash_table_section(bad, {{EMPTY_KEY, 0}}); }));
+        CHECK(refused([&] { btree_section(bad, {1, EMPTY_KEY}, {0, 0}); }));
+        CHECK(refused([&] { btree_section(bad, {1, 2}, {0}); }));
+        CHECK(refused([&] { btree_section(bad, {2, 1}, {0, 0}); }));
+        CHECK(refused([&] { btree_section(bad, {1, 1}, {0, 0}); }));
+        sorted_array_section(bad, keys);
+        CHECK(refused([&] { sorted_array_section(bad, keys); }));
+        bad.finish();
+        MappedIndex index(path);
+        CHECK(index.verify() && !index.section(SECTION_BTREE));
+        bool threw = false;
+        try {
+            BTreeView btree(index.section(SECTION_BTREE));
+        } catch (const runtime_error&) {
+            threw = true;
+        }
+        CHECK(threw);
+    }
+
+    {
+        fstream file(path, ios::in | ios::out | ios::binary);
+        file.seekg(8192);
+        char byte = file.get();
+        file.seekp(8192);
+        file.put(~byte);
+    }
+    CHECK(!MappedIndex(path).verify());
+    remove(path.c_str());
+}
+
+/**
+    The benchmark writes n_keys random (key, value) pairs as text, then times 
+    rebuilding the sorted array, hash table and B+-tree from that text, 
+    against opening the index file and running the first 1000 lookups. A 
+    cold start first evicts the file from the page cache with 
+    posix_fadvise(POSIX_FADV_DONTNEED), so every touched page comes from 
+    disk; a warm start finds them all cached. The kernel only evicts pages 
+    that are already on disk, which is why IndexWriter syncs the file. The 
+    rebuild writes its sections into that file's page cache, which costs 
+    about what building them in memory would, and the sync is not timed. The 
+    default size makes an index of about 10 GB.
+*/
+
+void index_sections(IndexWriter& writer, 
+                    vector<pair<uint64_t, uint64_t> > entries) {
+    sort(entries.begin(), entries.end());
+    entries.erase(unique(entries.begin(), entries.end(), 
+                         [](const auto& a, const auto& b) {
+                             return a.first == b.first;
+                         }), entries.end());
+    vector<uint64_t> keys(entries.size()), values(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        keys[i] = entries[i].first;
+        values[i] = entries[i].second;
+    }
+    sorted_array_section(writer, keys);
+    hash_table_section(writer, entries);
+    btree_section(writer, keys, values);
+}
+
+void mapped_index_benchmark(const string& dir = "/tmp", 
+                            size_t n_keys = 160000000) {
+    string text_path = dir + "/notes_index.txt";
+    string index_path = dir + "/notes_index.bin";
+    mt19937_64 rng(9);
+    vector<uint64_t> probes;
+    {
+        ofstream text(text_path);
+        for (size_t i = 0; i < n_keys; i++) {
+            uint64_t key = rng() >> 1, value = rng() >> 1;
+            text << key << ' ' << value << '\n';
+            if (i % (n_keys / 1000 + 1) == 0)
+                probes.push_back(key);
+        }
+    }
+
+    IndexWriter writer(index_path);
+    double rebuild = seconds([&] {
+        ifstream text(text_path);
+        vector<pair<uint64_t, uint64_t> > entries;
+        entries.reserve(n_keys);
+        uint64_t key, value;
+        while (text >> key >> value)
+            entries.emplace_back(key, value);
+        index_sections(writer, move(entries));
+    });
+    writer.finish();
+
+    auto startup = [&](bool cold, bool prefetch) {
+        if (cold) {
+            int fd = open(index_path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw runtime_error("cannot open " + index_path);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+        return seconds([&] {
+            MappedIndex index(index_path, prefetch);
+            HashTableView hash_table(index.section(SECTION_HASH_TABLE));
+            BTreeView btree(index.section(SECTION_BTREE));
+            for (uint64_t key : probes)
+                if (!hash_table.find(key) || !btree.find(key))
+                    throw logic_error("index lost a key");
+        });
+    };
+    cout << "rebuild from text: " << rebuild << " s, cold start: " 
+         << startup(true, false) << " s, cold start with prefetch: " 
+         << startup(true, true) << " s, warm start: " 
+         << startup(false, false) << " s" << endl;
+    remove(text_path.c_str());
+    remove(index_path.c_str());
+}
+
+
 /** VERSION CONTROL SOFTWARE
 
     git, CVS (Concurrent Versions System), SVN (subversion)
@@ -860,4 +5368,15 @@ void thread_example() {
     SSD so much faster.
 */
 
-int main () {}
+int main () {
+    test_expected();
+    test_concurrent_hash_map();
+    test_process_pool();
+    test_caching_allocator();
+    test_graph();
+    test_filters();
+    test_kernel_dispatch();
+    test_small_sorts();
+    test_mapped_index();
+    return check_failures == 0 ? 0 : 1;
+}